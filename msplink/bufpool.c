@@ -0,0 +1,68 @@
+/*
+This file is part of python-msptools.
+
+Python-msptools is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Python-msptools is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Buffers for frames too big for the link's own READ_BUFFER_SIZE buffer.
+
+Buffers come in a few size classes and are only allocated once a frame needs
+one. The classes below the largest are kept for the next big frame, so a
+settings dump in 4 KiB frames doesn't malloc() per frame, while the 64 KiB
+class is handed back as soon as its frame has been copied out. A zeroed pool
+is an empty one.
+
+A UDP link keeps a second pool for the part of a datagram that doesn't fit its
+receive ring, used the same way until the frame in it has been parsed.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "bufpool.h"
+#include "msplink.h"
+
+static const size_t bufpool_sizes[MSP_POOL_CLASSES] = {4096 + MSP_FRAME_OVERHEAD, 16384 + MSP_FRAME_OVERHEAD, MSP_FRAME_MAX};
+
+// Public interface
+
+// The smallest buffer that holds size bytes, or NULL if size is over MSP_FRAME_MAX or malloc() fails
+uint8_t* bufpool_get(mspbufpool_t* pool, size_t size) {
+
+    for (int i = 0; i < MSP_POOL_CLASSES; i++) {
+        if (size > bufpool_sizes[i]) {continue;}
+
+        if (pool->block[i] == NULL) {
+            pool->block[i] = malloc(bufpool_sizes[i]);
+        }
+
+        return pool->block[i];
+    }
+
+    return NULL;
+}
+
+// Call once the frame in a pool buffer has been used. Only the largest class is let go.
+void bufpool_trim(mspbufpool_t* pool) {
+    free(pool->block[MSP_POOL_CLASSES-1]);
+    pool->block[MSP_POOL_CLASSES-1] = NULL;
+}
+
+void bufpool_free(mspbufpool_t* pool) {
+    for (int i = 0; i < MSP_POOL_CLASSES; i++) {
+        free(pool->block[i]);
+        pool->block[i] = NULL;
+    }
+}
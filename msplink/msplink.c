@@ -17,6 +17,7 @@ along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
 
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
+#include <structmember.h>
 #include <stdint.h>
 #include <pthread.h>
 
@@ -24,6 +25,8 @@ along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
 #include "parse.h"
 #include "send.h"
 #include "serial.h"
+#include "rtt.h"
+#include "bufpool.h"
 
 // Custom Exceptions
 PyObject* MspExc_Exception = NULL;
@@ -125,6 +128,9 @@ int throwError(int returncode) {
         PyErr_SetString(MspExc_Exception,
             "You found an msplink bug. Please consider reporting it with example code on github!");
         break;
+    case MSP_RX_WOULDBLOCK:
+        PyErr_SetString(MspExc_NoResponse, "No complete response has arrived yet");
+        break;
     case MSP_OUT_OF_MEMORY:
         PyErr_SetString(PyExc_MemoryError,
             "Payload data does not fit in allocated buffer");
@@ -176,11 +182,255 @@ int throwPacketError(int returncode, mspPacket_t *rxPkt) {
     return returncode;
 }
 
+/**
+ *  Turn the outcome of a transaction into its Python result
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param retval   [in]    what the transaction returned
+ *
+ *  Returns the response packet, or NULL with an exception set. Call it before releasing
+ *  instanceLock: a large payload lives in the link's buffer pool, and its buffer is
+ *  given back here once the payload has been copied into Python objects.
+ */
+PyObject *finishResponse(mspdev_t* mdev, int retval) {
+    PyObject* result = NULL;
+
+    if (retval < 0) {throwPacketError(retval, &mspResponse);}
+    else            {result = packResponse(&mspResponse);}
+
+    bufpool_trim(&(mdev->pool));
+
+    return result;
+}
+
+/**
+ *  Get rid of stale input before a new request goes out
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *
+ *  With flush=True this is a tcflush() of both directions. Otherwise the buffered
+ *  input is dropped without a syscall and anything stale still arriving is left for
+ *  the parser to skip, so unsent TX bytes survive and the hot path stays in userspace.
+ *
+ *  Must be called with the GIL released.
+ */
+int prepareRequest(mspdev_t* mdev) {
+    if (!mdev->flush) {
+        msplink_discardRxBuffer(mdev);
+        return MSP_OK;
+    }
+
+    return msplink_clearRxBuffer(mdev);
+}
+
+/**
+ *  Frame and send a request in the link's MSP version
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param cmd      [in]    command number, already checked to fit the MSP version
+ *  @param flag     [in]    V2 flag byte
+ *  @param payload  [in]    payload data, may be NULL if len is 0
+ *  @param len      [in]    payload length
+ *
+ *  Must be called with the GIL released.
+ */
+int sendRequest(mspdev_t* mdev, uint16_t cmd, uint8_t flag, uint8_t* payload, uint16_t len) {
+    switch (mdev->mspversion) {
+        case 1:
+            return send_V1(mdev, (uint8_t)cmd, payload, len);
+        case 2:
+            return send_V2(mdev, flag, cmd, payload, len);
+        default:
+            return MSP_LIB_INTERNAL_ERROR;
+    }
+}
+
+// Rates tried by probe() when the caller doesn't give any, most common first
+static const int probeRatesDefault[] = {
+    115200, 57600, 230400, 250000, 400000, 460800, 500000, 921600,
+    1000000, 1500000, 2000000, 38400, 19200, 9600
+};
+
+/**
+ *  Try one candidate rate for probe()
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param baudrate [in]    the rate to try
+ *
+ *  Switches the port to baudrate, throws away whatever arrived at the old rate and
+ *  sends MSP_API_VERSION. Returns MSP_OK or MSP_RX_CLIENT_NACK if a frame with a good
+ *  checksum came back within the current timeouts.
+ *
+ *  Must be called with the GIL released.
+ */
+int probeRate(mspdev_t* mdev, int baudrate) {
+    int ret = MSP_OK;
+
+    ret = msplink_setbaudrate(mdev, baudrate);
+    if (ret<0) {return ret;}
+
+    ret = msplink_clearRxBuffer(mdev);
+    if (ret<0) {return ret;}
+
+    ret = sendRequest(mdev, MSP_API_VERSION, 0, NULL, 0);
+    if (ret<0) {return ret;}
+
+    return parse_packet(mdev, &mspResponse, MSP_NO_DEADLINE, MSP_API_VERSION);
+}
+
+/**
+ *  Wait for the response to a request that has just been written
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param cmd      [in]    the command that was sent
+ *  @param deadline [in]    the caller's transaction deadline, or MSP_NO_DEADLINE
+ *  @param retransmit [in]  whether the request was a retry
+ *
+ *  With adaptive_timeout and no deadline from the caller, the response gets the RTO
+ *  estimated for this command. Every outcome goes to the RTT estimator.
+ *
+ *  Must be called with the GIL released.
+ */
+int awaitResponse(mspdev_t* mdev, uint16_t cmd, int64_t deadline, int retransmit) {
+    int64_t sent = monotonic_us();
+    int adaptive = 0;
+    int ret;
+
+    if (deadline == MSP_NO_DEADLINE && mdev->adaptive_timeout) {
+        deadline = sent + rtt_timeout(mdev, cmd);
+        adaptive = 1;
+    }
+
+    ret = parse_packet(mdev, &mspResponse, deadline, cmd);
+    rtt_update(mdev, cmd, ret, &mspResponse, sent, adaptive, retransmit);
+
+    return ret;
+}
+
+// Failures worth sending the request again for. NACKs are an answer, and syscall failures won't fix themselves.
+int isRetryable(int ret) {
+    return (ret == MSP_RX_FAIL || ret == MSP_RX_SYNC_NOT_FOUND || ret == MSP_RX_CHECKSUM_MISMATCH);
+}
+
+// How long a call may spend getting a lost device back: the reconnect timeout, or less if the caller's deadline is sooner
+int64_t reconnectDeadline(mspdev_t* mdev, int64_t deadline) {
+    int64_t limit = monotonic_us() + mdev->reconnect_timeout_us;
+
+    if (deadline != MSP_NO_DEADLINE && deadline < limit) {return deadline;}
+    return limit;
+}
+
+/**
+ *  Run one request/response transaction, retrying it as the link's retry policy allows
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param cmd      [in]    command number, already checked to fit the MSP version
+ *  @param flag     [in]    V2 flag byte
+ *  @param payload  [in]    payload data, may be NULL if len is 0
+ *  @param len      [in]    payload length
+ *  @param deadline [in]    the caller's transaction deadline, or MSP_NO_DEADLINE
+ *  @param retries  [in]    how many times to send the request again after a lost or corrupted response
+ *
+ *  -Clear stale input, send the request, and wait for the response
+ *  -On a timeout or bad checksum, pause for the backoff (doubling it each time) and go again
+ *  -Stop when the retries run out or the next attempt couldn't start before the deadline
+ *  -With reconnect=True, a device that has gone away is reopened once per call and the request sent again
+ *
+ *  The response lands in mspResponse. Must be called with the GIL released, which is the point:
+ *  a retry doesn't need a trip through the interpreter.
+ */
+int runTransaction(mspdev_t* mdev, uint16_t cmd, uint8_t flag, uint8_t* payload, uint16_t len,
+                   int64_t deadline, int retries) {
+    int64_t backoff = mdev->retry_backoff_us;
+    int attempt = 0;
+    int reconnected = 0;
+    int ret = MSP_OK;
+
+    for (;;) {
+        ret = prepareRequest(mdev);
+        if (ret == MSP_OK) {ret = sendRequest(mdev, cmd, flag, payload, len);}
+        if (ret == MSP_OK) {ret = awaitResponse(mdev, cmd, deadline, attempt > 0);}
+
+        if (ret == MSP_SYSCALL_FAIL && mdev->reconnect && !reconnected && msplink_devicegone(mdev)) {
+            ret = msplink_reconnect(mdev, reconnectDeadline(mdev, deadline));
+            if (ret<0) {return ret;}
+
+            reconnected = 1;
+            continue;
+        }
+
+        if (!isRetryable(ret)) {
+            if (attempt > 0 && (ret == MSP_OK || ret == MSP_RX_CLIENT_NACK)) {mdev->stats.retry_recoveries++;}
+            return ret;
+        }
+
+        if (attempt >= retries ||
+            (deadline != MSP_NO_DEADLINE && monotonic_us() + backoff >= deadline)) {
+            if (retries > 0) {mdev->stats.retries_exhausted++;}
+            return ret;
+        }
+
+        if (backoff > 0) {
+            sleep_until(monotonic_us() + backoff);
+            backoff *= 2;
+        }
+
+        attempt++;
+        mdev->stats.tx_retries++;
+    }
+}
+
+/**
+ *  Turn the timeout and deadline parameters of get() and set() into a transaction deadline
+ *
+ *  @param pyoTimeout   [in]    seconds from now, or None
+ *  @param pyoDeadline  [in]    a time.monotonic() value, or None
+ *  @param deadline     [out]   absolute CLOCK_MONOTONIC time in microseconds, or MSP_NO_DEADLINE if neither was given
+ *
+ *  If both are given the earlier one wins. Returns 0, or -1 with a Python exception set.
+ */
+int callDeadline(PyObject* pyoTimeout, PyObject* pyoDeadline, int64_t* deadline) {
+    double value;
+    int64_t candidate;
+
+    *deadline = MSP_NO_DEADLINE;
+
+    if (pyoTimeout != Py_None) {
+        value = PyFloat_AsDouble(pyoTimeout);
+        if (value == -1.0 && PyErr_Occurred()) {return -1;}
+
+        if (!(value > 0) || value > 60.0) {
+            PyErr_Format(PyExc_ValueError, "timeout must be greater than 0 and at most 60 seconds");
+            return -1;
+        }
+        *deadline = monotonic_us() + (int64_t)(value * 1e6 + 0.5);
+    }
+
+    if (pyoDeadline != Py_None) {
+        value = PyFloat_AsDouble(pyoDeadline);
+        if (value == -1.0 && PyErr_Occurred()) {return -1;}
+
+        // time.monotonic() is CLOCK_MONOTONIC on Linux, so this is the same clock fd_wait() uses
+        if (!(value >= 0) || value > 1e12) {
+            PyErr_Format(PyExc_ValueError, "deadline must be a time.monotonic() value");
+            return -1;
+        }
+        candidate = (int64_t)(value * 1e6 + 0.5);
+
+        if (*deadline == MSP_NO_DEADLINE || candidate < *deadline) {*deadline = candidate;}
+    }
+
+    return 0;
+}
+
 /**
  *  Opens an MSP link to the given serial device
  *
- *  Python parameters are: serial_device, read_retries, and msp_version.
+ *  Python parameters are: serial_device, baudrate, read_retries, timeout, byte_timeout,
+ *  msp_version, low_latency, flush, io_uring, flow_control, latency_timer, sysfs_root, adaptive_timeout,
+ *  retries, retry_backoff, reconnect, reconnect_timeout, and half_duplex.
  *  serial_device is required, and may be a string or a Python path-like object.
+ *  timeout and byte_timeout are in seconds. If timeout is not given it is derived from read_retries.
  *
  *  This function is thread-safe, protected by a mutex against running concurrently
  *  with itself or other function calls.
@@ -188,11 +438,21 @@ int throwPacketError(int returncode, mspPacket_t *rxPkt) {
 static PyObject *pyMsplinkOpen(PyObject *self, PyObject *args, PyObject *kwargs)
 {
 
-    const char* PARAM_FORMAT = "O&|$ii:open";
-    char* PARAM_NAMES[] = {"serial_device", "read_retries", "msp_version", NULL};
+    const char* PARAM_FORMAT = "O&|$iiddippppOO&pidpdp:open";
+    char* PARAM_NAMES[] = {"serial_device", "baudrate", "read_retries", "timeout", "byte_timeout",
+                           "msp_version", "low_latency", "flush", "io_uring", "flow_control",
+                           "latency_timer", "sysfs_root", "adaptive_timeout", "retries", "retry_backoff",
+                           "reconnect", "reconnect_timeout", "half_duplex", NULL};
+
+    double timeout = -1.0;
+    double retry_backoff = 0.0;
+    double reconnect_timeout = MSP_RECONNECT_TIMEOUT_DEFAULT_US / 1e6;
+    double byte_timeout = MSP_BYTE_TIMEOUT_DEFAULT_US / 1e6;
 
     const char* devname;
     PyObject* pyoPath = NULL;       // This will be a PyBytesObject*
+    PyObject* pyoLatencyTimer = Py_None;
+    PyObject* pyoSysfsRoot = NULL;  // PyBytesObject* as well, only needed until msplink_open() returns
 
     int ret = 0;
 
@@ -222,17 +482,47 @@ static PyObject *pyMsplinkOpen(PyObject *self, PyObject *args, PyObject *kwargs)
         goto release_mutex_handler;
     }
 
+    // Options not given by the caller fall back to their defaults, not to whatever a previous open() used
+    mspDevice.baudrate = MSP_BAUDRATE_DEFAULT;
+    mspDevice.read_retries = MSP_RETRY_DEFAULT;
+    mspDevice.mspversion = 1;
+    mspDevice.low_latency = 0;
+    mspDevice.flush = 1;
+    mspDevice.io_uring = 0;
+    mspDevice.flow_control = 0;
+    mspDevice.half_duplex = 0;
+    mspDevice.adaptive_timeout = 0;
+    mspDevice.retries = 0;
+    mspDevice.reconnect = 0;
+    mspDevice.link_down = 0;
+
     if ( !PyArg_ParseTupleAndKeywords(
             args, 
             kwargs, 
             PARAM_FORMAT,
             PARAM_NAMES,
             PyUnicode_FSConverter, &pyoPath,    // pyoPath is a bytes object that must be released later!
+            &(mspDevice.baudrate),
             &(mspDevice.read_retries), 
-            &(mspDevice.mspversion)
+            &timeout,
+            &byte_timeout,
+            &(mspDevice.mspversion),
+            &(mspDevice.low_latency),
+            &(mspDevice.flush),
+            &(mspDevice.io_uring),
+            &(mspDevice.flow_control),
+            &pyoLatencyTimer,
+            PyUnicode_FSConverter, &pyoSysfsRoot,
+            &(mspDevice.adaptive_timeout),
+            &(mspDevice.retries),
+            &retry_backoff,
+            &(mspDevice.reconnect),
+            &reconnect_timeout,
+            &(mspDevice.half_duplex)
          )
     ) {
         Py_XDECREF(pyoPath);                    // just in case ParseTuple leaves a mess on failure
+        Py_XDECREF(pyoSysfsRoot);
         goto release_mutex_handler;
     }
 
@@ -240,13 +530,13 @@ static PyObject *pyMsplinkOpen(PyObject *self, PyObject *args, PyObject *kwargs)
     devname = PyBytes_AsString(pyoPath);
     if (devname == NULL) {
         Py_XDECREF(pyoPath);
-        goto release_mutex_handler;
+        goto release_sysfs_and_mutex_handler;
     }
 
     mspDevice.devname = malloc(PyBytes_Size(pyoPath)+1);
     if (mspDevice.devname == NULL) {
         PyErr_SetString(PyExc_MemoryError, "Unable to allocate space for device name string");
-        goto release_mutex_handler;
+        goto release_sysfs_and_mutex_handler;
     }
 
     // This may look weird but PyBytesObject's buffer is guaranteed to have len(o)+1 with a NULL terminator in that last location
@@ -257,29 +547,101 @@ static PyObject *pyMsplinkOpen(PyObject *self, PyObject *args, PyObject *kwargs)
 
     if (mspDevice.mspversion != 1 && mspDevice.mspversion != 2) {
         PyErr_Format(PyExc_ValueError, "msp_version must be 1 or 2 (got %i)", mspDevice.mspversion);
-        goto release_mutex_handler;
+        goto release_sysfs_and_mutex_handler;
+    }
+
+    if (mspDevice.baudrate <= 0) {
+        PyErr_Format(PyExc_ValueError,
+                    "baudrate must be a positive number (got %i, default is %i)",
+                    mspDevice.baudrate, MSP_BAUDRATE_DEFAULT);
+        goto release_sysfs_and_mutex_handler;
     }
 
     if (mspDevice.read_retries <= 0) {
         PyErr_Format(PyExc_ValueError,
                     "read_retries must be a positive number (got %i, default is %i)",
                     mspDevice.read_retries, MSP_RETRY_DEFAULT);
-        goto release_mutex_handler;
+        goto release_sysfs_and_mutex_handler;
+    }
+
+    if (timeout < 0) {
+        timeout = mspDevice.read_retries * (MSP_RETRY_PERIOD_US / 1e6);
+    }
+
+    if (timeout <= 0 || timeout > 60.0) {
+        PyErr_Format(PyExc_ValueError, "timeout must be greater than 0 and at most 60 seconds");
+        goto release_sysfs_and_mutex_handler;
+    }
+
+    if (byte_timeout <= 0 || byte_timeout > 60.0) {
+        PyErr_Format(PyExc_ValueError, "byte_timeout must be greater than 0 and at most 60 seconds");
+        goto release_sysfs_and_mutex_handler;
+    }
+
+    if (mspDevice.retries < 0 || mspDevice.retries > 100) {
+        PyErr_Format(PyExc_ValueError, "retries must be between 0 and 100 (got %i)", mspDevice.retries);
+        goto release_sysfs_and_mutex_handler;
+    }
+
+    if (!(retry_backoff >= 0) || retry_backoff > 60.0) {
+        PyErr_Format(PyExc_ValueError, "retry_backoff must be between 0 and 60 seconds");
+        goto release_sysfs_and_mutex_handler;
+    }
+
+    if (!(reconnect_timeout > 0) || reconnect_timeout > 600.0) {
+        PyErr_Format(PyExc_ValueError, "reconnect_timeout must be greater than 0 and at most 600 seconds");
+        goto release_sysfs_and_mutex_handler;
+    }
+
+    mspDevice.timeout_us = (int)(timeout * 1e6 + 0.5);
+    mspDevice.byte_timeout_us = (int)(byte_timeout * 1e6 + 0.5);
+    mspDevice.retry_backoff_us = (int)(retry_backoff * 1e6 + 0.5);
+    mspDevice.reconnect_timeout_us = (int)(reconnect_timeout * 1e6 + 0.5);
+
+    mspDevice.latency_timer = -1;
+    if (pyoLatencyTimer != Py_None) {
+        long latency_timer = PyLong_AsLong(pyoLatencyTimer);
+        if (latency_timer == -1 && PyErr_Occurred()) {goto release_sysfs_and_mutex_handler;}
+
+        if (latency_timer < 1 || latency_timer > 255) {
+            PyErr_Format(PyExc_ValueError, "latency_timer must be between 1 and 255 ms (got %li)", latency_timer);
+            goto release_sysfs_and_mutex_handler;
+        }
+        mspDevice.latency_timer = (int)latency_timer;
     }
 
+    // Our own copy, the bytes object goes away before the link does, and a reconnect
+    // sets the latency timer under the same root again
+    mspDevice.sysfs_root = NULL;
+    if (pyoSysfsRoot != NULL) {
+        mspDevice.sysfs_root = strdup(PyBytes_AsString(pyoSysfsRoot));
+        if (mspDevice.sysfs_root == NULL) {
+            PyErr_SetString(PyExc_MemoryError, "Unable to allocate space for sysfs_root string");
+            goto release_sysfs_and_mutex_handler;
+        }
+    }
+    Py_XDECREF(pyoSysfsRoot);
+
     Py_BEGIN_ALLOW_THREADS
-    ret = msplink_open(&mspDevice);
+    ret = msplink_open(&mspDevice, MSP_NO_DEADLINE);
     Py_END_ALLOW_THREADS
+
     if (ret<0) {
+        free(mspDevice.sysfs_root);
+        mspDevice.sysfs_root = NULL;
         throwError(ret);
         goto release_mutex_handler;
     }
 
+    memset(&mspDevice.stats, 0, sizeof(mspDevice.stats));
+    rtt_reset(&mspDevice);
     mspDevice.device_open = 1;
     pthread_mutex_unlock(&(mdev->instanceLock));
 
     Py_RETURN_NONE;
 
+release_sysfs_and_mutex_handler:
+    Py_XDECREF(pyoSysfsRoot);
 release_mutex_handler:
     pthread_mutex_unlock(&(mdev->instanceLock));
     return NULL;
@@ -300,8 +662,13 @@ static PyObject *pyMsplinkClose(PyObject *self, PyObject __attribute__((__unused
     pthread_mutex_lock(&(mdev->instanceLock));
     Py_END_ALLOW_THREADS
 
+    // There's no transport state left to tear down on a closed link
     if (!mspDevice.device_open) {
-        PyErr_WarnEx(PyExc_ResourceWarning, "You appear to be closing an already closed msplink.", 1);
+        if (PyErr_WarnEx(PyExc_ResourceWarning, "You appear to be closing an already closed msplink.", 1) < 0) {
+            goto release_mutex_handler;
+        }
+        pthread_mutex_unlock(&(mdev->instanceLock));
+        Py_RETURN_NONE;
     }
 
     if (mspDevice.devname != NULL) {
@@ -309,6 +676,9 @@ static PyObject *pyMsplinkClose(PyObject *self, PyObject __attribute__((__unused
         mspDevice.devname = NULL;
     }
 
+    free(mspDevice.sysfs_root);
+    mspDevice.sysfs_root = NULL;
+
     mspDevice.device_open = 0;
 
     if (throwError(msplink_close(&mspDevice)) < 0) {goto release_mutex_handler;}
@@ -321,27 +691,236 @@ release_mutex_handler:
     return NULL;
 }
 
+/**
+ *  Describes the open MSP link
+ *
+ *  Returns a dict with the device, the settings in use, and which of the
+ *  requested latency tunings the driver actually accepted.
+ *
+ *  This function is thread-safe, protected by a mutex against running concurrently
+ *  with itself or other function calls.
+ */
+static PyObject *pyMsplinkInfo(PyObject *self, PyObject __attribute__((__unused__)) *always_null)
+{
+    mspdev_t *mdev = &mspDevice;
+    PyObject* info = NULL;
+    PyObject* devname = NULL;
+    PyObject* latency_timer = NULL;
+    PyObject* latency_timer_previous = NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&(mdev->instanceLock));
+    Py_END_ALLOW_THREADS
+
+    if (!mspDevice.device_open) {
+        PyErr_SetString(MspExc_Exception, "You must call msplink.open successfully first");
+        goto release_mutex_handler;
+    }
+
+    devname = PyUnicode_DecodeFSDefault(mspDevice.devname);
+    if (devname == NULL) {goto release_mutex_handler;}
+
+    if (mspDevice.tunings & MSP_TUNE_LATENCY_TIMER) {
+        latency_timer = PyLong_FromLong(mspDevice.latency_timer);
+        latency_timer_previous = PyLong_FromLong(mspDevice.saved_latency_timer);
+    }
+    else {
+        latency_timer = Py_None;
+        latency_timer_previous = Py_None;
+        Py_INCREF(latency_timer);
+        Py_INCREF(latency_timer_previous);
+    }
+    if (latency_timer == NULL || latency_timer_previous == NULL) {goto release_objects_handler;}
+
+    info = Py_BuildValue("{s:O,s:s,s:i,s:i,s:d,s:d,s:O,s:O,s:O,s:O,s:O,s:i,s:d,s:O,s:d,s:O,s:O,s:O,s:O,s:O,s:O,s:O}",
+        "serial_device", devname,
+        "transport", mspDevice.transport->name,
+        "baudrate", mspDevice.baudrate,
+        "msp_version", mspDevice.mspversion,
+        "timeout", mspDevice.timeout_us / 1e6,
+        "byte_timeout", mspDevice.byte_timeout_us / 1e6,
+        "low_latency", mspDevice.low_latency ? Py_True : Py_False,
+        "flow_control", mspDevice.flow_control ? Py_True : Py_False,
+        "half_duplex", mspDevice.half_duplex ? Py_True : Py_False,
+        "flush", mspDevice.flush ? Py_True : Py_False,
+        "adaptive_timeout", mspDevice.adaptive_timeout ? Py_True : Py_False,
+        "retries", mspDevice.retries,
+        "retry_backoff", mspDevice.retry_backoff_us / 1e6,
+        "reconnect", mspDevice.reconnect ? Py_True : Py_False,
+        "reconnect_timeout", mspDevice.reconnect_timeout_us / 1e6,
+        "link_up", mspDevice.link_down ? Py_False : Py_True,
+        "o_sync", (mspDevice.transport == &msptransport_serial && !(mspDevice.tunings & MSP_TUNE_NO_OSYNC)) ? Py_True : Py_False,
+        "async_low_latency", (mspDevice.tunings & MSP_TUNE_ASYNC_LOW_LATENCY) ? Py_True : Py_False,
+        "tcp_nodelay", (mspDevice.tunings & MSP_TUNE_TCP_NODELAY) ? Py_True : Py_False,
+        "io_uring", (mspDevice.tunings & MSP_TUNE_IO_URING) ? Py_True : Py_False,
+        "latency_timer", latency_timer,
+        "latency_timer_previous", latency_timer_previous);
+
+release_objects_handler:
+    Py_DECREF(devname);
+    Py_XDECREF(latency_timer);
+    Py_XDECREF(latency_timer_previous);
+
+release_mutex_handler:
+    pthread_mutex_unlock(&(mdev->instanceLock));
+    return info;
+}
+
+/**
+ *  Returns the link statistics
+ *
+ *  Counters are reset by open() and stay readable after close().
+ *
+ *  This function is thread-safe, protected by a mutex against running concurrently
+ *  with itself or other function calls.
+ */
+static PyObject *pyMsplinkStats(PyObject *self, PyObject __attribute__((__unused__)) *always_null)
+{
+    mspdev_t *mdev = &mspDevice;
+    mspstats_t stats;
+    int has_linecount;
+    PyObject* dict = NULL;
+    PyObject* value = NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&(mdev->instanceLock));
+    Py_END_ALLOW_THREADS
+
+    if (mspDevice.device_open) {msplink_updatelinestats(&mspDevice);}
+
+    stats = mspDevice.stats;
+    has_linecount = mspDevice.has_linecount;
+
+    // Count an outage that is still going on, too
+    if (mspDevice.device_open && mspDevice.link_down) {
+        stats.downtime_us += monotonic_us() - mspDevice.down_since;
+    }
+
+    pthread_mutex_unlock(&(mdev->instanceLock));
+
+    const struct {const char* name; uint64_t value;} linecounts[] = {
+        {"rx_overruns", stats.rx_overruns},
+        {"rx_framing_errors", stats.rx_framing_errors},
+        {"rx_parity_errors", stats.rx_parity_errors},
+        {"rx_breaks", stats.rx_breaks},
+        {"rx_buffer_overruns", stats.rx_buffer_overruns},
+    };
+
+    dict = Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:d}",
+        "tx_frames", (unsigned long long)stats.tx_frames,
+        "rx_frames", (unsigned long long)stats.rx_frames,
+        "rx_timeouts", (unsigned long long)stats.rx_timeouts,
+        "rx_checksum_errors", (unsigned long long)stats.rx_checksum_errors,
+        "rx_discarded_bytes", (unsigned long long)stats.rx_discarded_bytes,
+        "rx_resyncs", (unsigned long long)stats.rx_resyncs,
+        "rx_resync_skipped_bytes", (unsigned long long)stats.rx_resync_skipped_bytes,
+        "rx_flushes", (unsigned long long)stats.rx_flushes,
+        "rx_dropped_datagrams", (unsigned long long)stats.rx_dropped_datagrams,
+        "rx_echo_frames", (unsigned long long)stats.rx_echo_frames,
+        "rx_unmatched_frames", (unsigned long long)stats.rx_unmatched_frames,
+        "tx_retries", (unsigned long long)stats.tx_retries,
+        "retry_recoveries", (unsigned long long)stats.retry_recoveries,
+        "retries_exhausted", (unsigned long long)stats.retries_exhausted,
+        "tx_queue_peak", (unsigned long long)stats.tx_queue_peak,
+        "link_drops", (unsigned long long)stats.link_drops,
+        "reconnects", (unsigned long long)stats.reconnects,
+        "downtime", stats.downtime_us / 1e6);
+    if (dict == NULL) {return NULL;}
+
+    // The UART counters are None where the driver doesn't keep them
+    for (size_t i = 0; i < sizeof(linecounts) / sizeof(linecounts[0]); i++) {
+        if (has_linecount) {
+            value = PyLong_FromUnsignedLongLong(linecounts[i].value);
+            if (value == NULL) {goto release_dict_handler;}
+        }
+        else {
+            value = Py_None;
+            Py_INCREF(value);
+        }
+
+        if (PyDict_SetItemString(dict, linecounts[i].name, value) != 0) {
+            Py_DECREF(value);
+            goto release_dict_handler;
+        }
+        Py_DECREF(value);
+    }
+
+    return dict;
+
+release_dict_handler:
+    Py_DECREF(dict);
+    return NULL;
+}
+
+/**
+ *  Returns the round-trip time estimate for a command
+ *
+ *  Python parameters are: command, which is required.
+ *
+ *  Returns a dict of srtt, rttvar, and rto in seconds, or None if the command hasn't been
+ *  answered since open(). Estimates are kept whether or not adaptive_timeout is on.
+ *
+ *  This function is thread-safe, protected by a mutex against running concurrently
+ *  with itself or other function calls.
+ */
+static PyObject *pyMsplinkRtt(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    const char* PARAM_FORMAT = "H:rtt";
+    char* PARAM_NAMES[] = {"command", NULL};
+
+    mspdev_t *mdev = &mspDevice;
+    const msprtt_t* found;
+    msprtt_t estimate;
+    uint16_t cmd = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, PARAM_FORMAT, PARAM_NAMES, &cmd)) {return NULL;}
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&(mdev->instanceLock));
+    Py_END_ALLOW_THREADS
+
+    found = rtt_lookup(&mspDevice, cmd);
+    if (found != NULL) {estimate = *found;}
+
+    pthread_mutex_unlock(&(mdev->instanceLock));
+
+    if (found == NULL) {Py_RETURN_NONE;}
+
+    return Py_BuildValue("{s:d,s:d,s:d}",
+        "srtt", estimate.srtt_us / 1e6,
+        "rttvar", estimate.rttvar_us / 1e6,
+        "rto", estimate.rto_us / 1e6);
+}
+
 /**
  *  Sends the given command and payload data to the MSP responder
  *
- *  Python parameters are: command, payload, flag, and wait_for_ack.
- *  command and payload are required.
+ *  Python parameters are: command, payload, flag, wait_for_ack, timeout, deadline, and retry.
+ *  command and payload are required. timeout (seconds from now) and deadline (a time.monotonic()
+ *  value) bound the whole transaction in place of the link's response timeout. Since a command
+ *  that changes something may not be safe to repeat, the link's retry policy only applies
+ *  with retry=True.
  *
  *  This function is thread-safe, protected by a mutex against running concurrently
  *  with itself or other function calls.
  */
 static PyObject *pyMsplinkSet(PyObject *self, PyObject *args, PyObject *kwargs) {
 
-    const char* PARAM_FORMAT = "hy*|$bp:set";
-    char* PARAM_NAMES[] = {"command", "payload", "flag", "wait_for_ack", NULL};
+    const char* PARAM_FORMAT = "hy*|$bpOOp:set";
+    char* PARAM_NAMES[] = {"command", "payload", "flag", "wait_for_ack", "timeout", "deadline", "retry", NULL};
 
 
     uint16_t cmd=0;
     uint8_t flag=0;
     int wait_for_ack=1;
+    int retry=0;
     Py_buffer payload;
+    PyObject* pyoTimeout = Py_None;
+    PyObject* pyoDeadline = Py_None;
+    int64_t deadline = MSP_NO_DEADLINE;
 
     int retval = MSP_OK;
+    PyObject* result = NULL;
 
     mspdev_t *mdev = &mspDevice;
 
@@ -364,73 +943,61 @@ static PyObject *pyMsplinkSet(PyObject *self, PyObject *args, PyObject *kwargs)
         &cmd, 
         &payload, 
         &flag, 
-        &wait_for_ack
+        &wait_for_ack,
+        &pyoTimeout,
+        &pyoDeadline,
+        &retry
     )
-    ) {goto release_buffer_and_mutex_handler;}
+    ) {goto release_mutex_handler;}
 
     // Note: From this point on, Py_buffer payload needs to be released to prevent a memory leak!
 
+    if (callDeadline(pyoTimeout, pyoDeadline, &deadline) != 0) {
+        goto release_buffer_and_mutex_handler;
+    }
+
     if(!PyBuffer_IsContiguous(&payload, 'C')) {
         PyErr_SetString(PyExc_BufferError, "Input data must be a bytes-like object with contiguous layout");
         goto release_buffer_and_mutex_handler;
     }
 
-    Py_BEGIN_ALLOW_THREADS
-    retval = msplink_clearRxBuffer(&mspDevice);
-    Py_END_ALLOW_THREADS
-
-    if(retval < 0) {
-        throwError(retval);
+    if (payload.len > UINT16_MAX) {
+        PyErr_SetString(PyExc_ValueError, "Payload can't be longer than 65535 bytes");
         goto release_buffer_and_mutex_handler;
     }
 
-    switch (mspDevice.mspversion) {
-        case 1:
-            if (cmd > 255) {
-                PyErr_SetString(PyExc_ValueError, "Command can't be greater than 255 when using MSP v1");
-                goto release_buffer_and_mutex_handler;
-            }
-            Py_BEGIN_ALLOW_THREADS
-            retval = send_V1(&mspDevice, cmd, payload.buf, payload.len);
-            Py_END_ALLOW_THREADS
-            if (retval < 0) {
-                throwError(retval);
-                goto release_buffer_and_mutex_handler;
-            }
-            break;
-        case 2:
-            Py_BEGIN_ALLOW_THREADS
-            retval = send_V2(&mspDevice, flag, cmd, payload.buf, payload.len);
-            Py_END_ALLOW_THREADS
-            if (retval < 0) {
-                throwError(retval);
-                goto release_buffer_and_mutex_handler;
-            }
-            break;
-        default:
-            PyErr_SetString(MspExc_Exception,
-                "You found an msplink bug in pyMsplinkSet(). Please consider reporting it with example code on github!");
-            goto release_buffer_and_mutex_handler;
+    if (mspDevice.mspversion == 1 && cmd > 255) {
+        PyErr_SetString(PyExc_ValueError, "Command can't be greater than 255 when using MSP v1");
+        goto release_buffer_and_mutex_handler;
     }
 
-    PyBuffer_Release(&payload);     // input payload is no longer needed, go ahead and allow Python to reclaim it
-
-
     // Usually you will want to wait on the ACK packet. This can be bypassed for speed if you're careful,
     // but if the client has a shared TX/RX buffer it can cause problems.
     if (wait_for_ack) {
 
         Py_BEGIN_ALLOW_THREADS
-        retval = parse_packet(&mspDevice, &mspResponse);
+        retval = runTransaction(&mspDevice, cmd, flag, payload.buf, payload.len, deadline,
+                                retry ? mspDevice.retries : 0);
         Py_END_ALLOW_THREADS
-        if(retval < 0) {
-            throwPacketError(retval, &mspResponse);
-            goto release_mutex_handler;
-        }
 
-        // Otherwise just return what we got as-is
+        PyBuffer_Release(&payload);     // input payload is no longer needed, go ahead and allow Python to reclaim it
+
+        result = finishResponse(mdev, retval);
+
         pthread_mutex_unlock(&(mdev->instanceLock));
-        return packResponse(&mspResponse);      // normal termination with response
+        return result;                          // normal termination with response, or the exception for what went wrong
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    retval = prepareRequest(&mspDevice);
+    if (retval == MSP_OK) {retval = sendRequest(&mspDevice, cmd, flag, payload.buf, payload.len);}
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&payload);
+
+    if (retval < 0) {
+        throwError(retval);
+        goto release_mutex_handler;
     }
 
     pthread_mutex_unlock(&(mdev->instanceLock));
@@ -448,7 +1015,10 @@ release_mutex_handler:
 /**
  *  Gets the requested data from an MSP responder
  *
- *  Python parameters are: command and flag, where command is required.
+ *  Python parameters are: command, flag, timeout, and deadline, where command is required.
+ *  timeout (seconds from now) and deadline (a time.monotonic() value) bound the whole
+ *  transaction in place of the link's response timeout. Reading is always safe to repeat,
+ *  so the link's retry policy applies.
  *
  *  On success, this function returns the requested data in the payload field
  *  of an MspPacketType object.
@@ -459,12 +1029,16 @@ release_mutex_handler:
 static PyObject *pyMsplinkGet(PyObject *self, PyObject *args, PyObject *kwargs) {
 
 
-    const char* PARAM_FORMAT = "h|$b:get";
-    char* PARAM_NAMES[] = {"command", "flag", NULL};
+    const char* PARAM_FORMAT = "h|$bOO:get";
+    char* PARAM_NAMES[] = {"command", "flag", "timeout", "deadline", NULL};
 
     uint16_t cmd=0;
     uint8_t flag=0;
+    PyObject* pyoTimeout = Py_None;
+    PyObject* pyoDeadline = Py_None;
+    int64_t deadline = MSP_NO_DEADLINE;
     int retval = MSP_OK;
+    PyObject* result = NULL;
 
     mspdev_t *mdev = &mspDevice;
 
@@ -484,64 +1058,496 @@ static PyObject *pyMsplinkGet(PyObject *self, PyObject *args, PyObject *kwargs)
         kwargs, 
         PARAM_FORMAT,
         PARAM_NAMES,
-        &cmd, &flag
+        &cmd, &flag, &pyoTimeout, &pyoDeadline
     )
     ) {goto release_mutex_handler;}
 
+    if (callDeadline(pyoTimeout, pyoDeadline, &deadline) != 0) {
+        goto release_mutex_handler;
+    }
+
+    if (mspDevice.mspversion == 1 && cmd > 255) {
+        PyErr_SetString(PyExc_ValueError, "Command can't be greater than 255 when using MSP v1");
+        goto release_mutex_handler;
+    }
 
     Py_BEGIN_ALLOW_THREADS
-    retval = msplink_clearRxBuffer(&mspDevice);
+    retval = runTransaction(&mspDevice, cmd, flag, NULL, 0, deadline, mspDevice.retries);
     Py_END_ALLOW_THREADS
-    if(retval < 0) {
+
+    result = finishResponse(mdev, retval);
+
+    pthread_mutex_unlock(&(mdev->instanceLock));
+    return result;
+
+release_mutex_handler:
+    pthread_mutex_unlock(&(mdev->instanceLock));
+    return NULL;
+}
+
+/**
+ *  Returns the file descriptor to watch for input in an outside event loop
+ *
+ *  This is the device or socket fd, or the io_uring fd when io_uring=True, and becomes
+ *  readable when poll_response() may have something to return.
+ *
+ *  This function is thread-safe, protected by a mutex against running concurrently
+ *  with itself or other function calls.
+ */
+static PyObject *pyMsplinkFileno(PyObject *self, PyObject __attribute__((__unused__)) *always_null) {
+
+    int retval = MSP_OK;
+
+    mspdev_t *mdev = &mspDevice;
+
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&(mdev->instanceLock));
+    Py_END_ALLOW_THREADS
+
+    if (!mspDevice.device_open) {
+        PyErr_SetString(MspExc_Exception, "You must call msplink.open successfully first");
+        goto release_mutex_handler;
+    }
+
+    retval = msplink_fileno(&mspDevice);
+    if (retval < 0) {
         throwError(retval);
         goto release_mutex_handler;
     }
 
-    switch (mspDevice.mspversion) {
-        case 1:
-            if (cmd > 255) {
-                PyErr_SetString(PyExc_ValueError, "Command can't be greater than 255 when using MSP v1");
-                goto release_mutex_handler;
-            }
-            Py_BEGIN_ALLOW_THREADS
-            retval = send_V1(&mspDevice, (uint8_t)cmd, NULL, 0);
-            Py_END_ALLOW_THREADS
-            if(retval < 0) {
-                throwError(retval);
-                goto release_mutex_handler;
+    pthread_mutex_unlock(&(mdev->instanceLock));
+    return PyLong_FromLong(retval);
+
+release_mutex_handler:
+    pthread_mutex_unlock(&(mdev->instanceLock));
+    return NULL;
+}
+
+/**
+ *  Sends a request without waiting for the response
+ *
+ *  Python parameters are: command, payload, and flag, where command is required.
+ *
+ *  Stale input is left alone, so responses to earlier requests that are still on
+ *  their way can be picked up with poll_response(). The command is remembered so
+ *  poll_response() can tell its response from other traffic.
+ *
+ *  This function is thread-safe, protected by a mutex against running concurrently
+ *  with itself or other function calls.
+ */
+static PyObject *pyMsplinkSendRequest(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+    const char* PARAM_FORMAT = "h|y*$b:send_request";
+    char* PARAM_NAMES[] = {"command", "payload", "flag", NULL};
+
+    uint16_t cmd=0;
+    uint8_t flag=0;
+    Py_buffer payload = {.buf = NULL, .obj = NULL, .len = 0};
+
+    int retval = MSP_OK;
+
+    mspdev_t *mdev = &mspDevice;
+
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&(mdev->instanceLock));
+    Py_END_ALLOW_THREADS
+
+    if (!mspDevice.device_open) {
+        PyErr_SetString(MspExc_Exception, "You must call msplink.open successfully first");
+        goto release_mutex_handler;
+    }
+
+    if (
+    !PyArg_ParseTupleAndKeywords(
+        args,
+        kwargs,
+        PARAM_FORMAT,
+        PARAM_NAMES,
+        &cmd,
+        &payload,
+        &flag
+    )
+    ) {goto release_buffer_and_mutex_handler;}
+
+    // Note: From this point on, Py_buffer payload needs to be released to prevent a memory leak!
+
+    if (payload.obj != NULL && !PyBuffer_IsContiguous(&payload, 'C')) {
+        PyErr_SetString(PyExc_BufferError, "Input data must be a bytes-like object with contiguous layout");
+        goto release_buffer_and_mutex_handler;
+    }
+
+    if (payload.len > UINT16_MAX) {
+        PyErr_SetString(PyExc_ValueError, "Payload can't be longer than 65535 bytes");
+        goto release_buffer_and_mutex_handler;
+    }
+
+    if (mspDevice.mspversion == 1 && cmd > 255) {
+        PyErr_SetString(PyExc_ValueError, "Command can't be greater than 255 when using MSP v1");
+        goto release_buffer_and_mutex_handler;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    retval = sendRequest(&mspDevice, cmd, flag, payload.buf, payload.len);
+    Py_END_ALLOW_THREADS
+    if (retval < 0) {
+        throwError(retval);
+        goto release_buffer_and_mutex_handler;
+    }
+
+    parse_expect(&mspDevice, cmd);
+
+    PyBuffer_Release(&payload);
+    pthread_mutex_unlock(&(mdev->instanceLock));
+    Py_RETURN_NONE;
+
+release_buffer_and_mutex_handler:
+    PyBuffer_Release(&payload);
+release_mutex_handler:
+    pthread_mutex_unlock(&(mdev->instanceLock));
+    return NULL;
+}
+
+/**
+ *  Returns the next response if a whole one has arrived, or None
+ *
+ *  Never waits for input. A partly received frame stays buffered for the next call,
+ *  so this can be called whenever fileno() turns readable. Several responses may arrive
+ *  at once, so keep calling until it returns None. A reconnect=True link that is down
+ *  is reopened first, for up to reconnect_timeout, like get() would.
+ *
+ *  This function is thread-safe, protected by a mutex against running concurrently
+ *  with itself or other function calls.
+ */
+static PyObject *pyMsplinkPollResponse(PyObject *self, PyObject __attribute__((__unused__)) *always_null) {
+
+    int retval = MSP_OK;
+    PyObject* result = NULL;
+
+    mspdev_t *mdev = &mspDevice;
+
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&(mdev->instanceLock));
+    Py_END_ALLOW_THREADS
+
+    if (!mspDevice.device_open) {
+        PyErr_SetString(MspExc_Exception, "You must call msplink.open successfully first");
+        goto release_mutex_handler;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    // There is no fd to poll while the link is down; the responses sent for are gone anyway
+    if (mspDevice.link_down) {
+        retval = msplink_reconnect(&mspDevice, reconnectDeadline(&mspDevice, MSP_NO_DEADLINE));
+    }
+    if (retval == MSP_OK) {retval = parse_poll(&mspDevice, &mspResponse);}
+    Py_END_ALLOW_THREADS
+
+    if (retval == MSP_RX_WOULDBLOCK) {
+        pthread_mutex_unlock(&(mdev->instanceLock));
+        Py_RETURN_NONE;
+    }
+
+    result = finishResponse(mdev, retval);
+
+    pthread_mutex_unlock(&(mdev->instanceLock));
+    return result;
+
+release_mutex_handler:
+    pthread_mutex_unlock(&(mdev->instanceLock));
+    return NULL;
+}
+
+/**
+ *  Finds the baud rate the responder is listening at
+ *
+ *  Python parameters are: rates and timeout, both optional. rates is a sequence of
+ *  candidate baud rates to try in order, timeout is how long to wait for an answer at
+ *  each one, in seconds.
+ *
+ *  The serial port is re-programmed in place for each rate and an MSP_API_VERSION request
+ *  is sent. The first rate that brings back a frame with a good checksum is kept and
+ *  returned. If none does, the original rate is restored and None is returned.
+ *
+ *  This function is thread-safe, protected by a mutex against running concurrently
+ *  with itself or other function calls.
+ */
+static PyObject *pyMsplinkProbe(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+    const char* PARAM_FORMAT = "|Od:probe";
+    char* PARAM_NAMES[] = {"rates", "timeout", NULL};
+
+    PyObject* pyoRates = Py_None;
+    PyObject* pyoSeq = NULL;
+    double timeout = MSP_PROBE_TIMEOUT_DEFAULT_US / 1e6;
+
+    const int* rates = probeRatesDefault;
+    int* ratesBuf = NULL;
+    Py_ssize_t rateCount = sizeof(probeRatesDefault) / sizeof(probeRatesDefault[0]);
+
+    int savedBaudrate, savedTimeout, savedByteTimeout;
+    int found = 0;                  // the rate that answered
+    int retval = MSP_OK;
+
+    mspdev_t *mdev = &mspDevice;
+
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&(mdev->instanceLock));
+    Py_END_ALLOW_THREADS
+
+    if (!mspDevice.device_open) {
+        PyErr_SetString(MspExc_Exception, "You must call msplink.open successfully first");
+        goto release_mutex_handler;
+    }
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, PARAM_FORMAT, PARAM_NAMES, &pyoRates, &timeout)) {
+        goto release_mutex_handler;
+    }
+
+    if (mspDevice.transport != &msptransport_serial) {
+        PyErr_SetString(PyExc_ValueError, "probe() only works on serial devices");
+        goto release_mutex_handler;
+    }
+
+    if (timeout <= 0 || timeout > 60.0) {
+        PyErr_Format(PyExc_ValueError, "timeout must be greater than 0 and at most 60 seconds");
+        goto release_mutex_handler;
+    }
+
+    if (pyoRates != Py_None) {
+        pyoSeq = PySequence_Fast(pyoRates, "rates must be a sequence of baud rates");
+        if (pyoSeq == NULL) {goto release_mutex_handler;}
+
+        rateCount = PySequence_Fast_GET_SIZE(pyoSeq);
+        ratesBuf = malloc((rateCount + 1) * sizeof(int));
+        if (ratesBuf == NULL) {
+            PyErr_SetString(PyExc_MemoryError, "Unable to allocate space for the baud rate list");
+            goto release_rates_and_mutex_handler;
+        }
+
+        for (Py_ssize_t i = 0; i < rateCount; i++) {
+            long rate = PyLong_AsLong(PySequence_Fast_GET_ITEM(pyoSeq, i));
+            if (rate == -1 && PyErr_Occurred()) {goto release_rates_and_mutex_handler;}
+
+            if (rate <= 0 || rate > INT32_MAX) {
+                PyErr_Format(PyExc_ValueError, "baud rates must be positive numbers (got %li)", rate);
+                goto release_rates_and_mutex_handler;
             }
+            ratesBuf[i] = (int)rate;
+        }
+
+        rates = ratesBuf;
+    }
+
+    savedBaudrate = mspDevice.baudrate;
+    savedTimeout = mspDevice.timeout_us;
+    savedByteTimeout = mspDevice.byte_timeout_us;
+
+    mspDevice.timeout_us = (int)(timeout * 1e6 + 0.5);
+    mspDevice.byte_timeout_us = mspDevice.timeout_us;
+
+    Py_BEGIN_ALLOW_THREADS
+    for (Py_ssize_t i = 0; i < rateCount; i++) {
+        retval = probeRate(&mspDevice, rates[i]);
+
+        if (retval == MSP_OK || retval == MSP_RX_CLIENT_NACK) {
+            found = rates[i];
+            retval = MSP_OK;
             break;
-        case 2:
-            Py_BEGIN_ALLOW_THREADS
-            retval = send_V2(&mspDevice, flag, cmd, NULL, 0);
-            Py_END_ALLOW_THREADS
-            if(retval < 0) {
-                throwError(retval);
-                goto release_mutex_handler;
+        }
+
+        if (retval == MSP_SYSCALL_FAIL) {
+            // A rate the driver won't program isn't the one, but the port is still fine
+            if (mspDevice.errornum == EINVAL) {
+                retval = MSP_OK;
+                continue;
             }
             break;
-        default:
-            PyErr_SetString(MspExc_Exception,
-                "You found an msplink bug in pyMsplinkGet(). Please consider reporting it with example code on github!");
-            goto release_mutex_handler;
+        }
     }
 
-    Py_BEGIN_ALLOW_THREADS
-    retval = parse_packet(&mspDevice, &mspResponse);
+    // Leave the port the way we found it if nobody answered
+    if (!found && retval != MSP_SYSCALL_FAIL) {
+        retval = msplink_setbaudrate(&mspDevice, savedBaudrate);
+    }
     Py_END_ALLOW_THREADS
-    if(retval < 0) {
-        throwPacketError(retval, &mspResponse);
-        goto release_mutex_handler;
+
+    mspDevice.timeout_us = savedTimeout;
+    mspDevice.byte_timeout_us = savedByteTimeout;
+
+    if (retval == MSP_SYSCALL_FAIL) {
+        throwError(retval);
+        goto release_rates_and_mutex_handler;
     }
 
+    free(ratesBuf);
+    Py_XDECREF(pyoSeq);
     pthread_mutex_unlock(&(mdev->instanceLock));
-    return packResponse(&mspResponse);
 
+    if (!found) {Py_RETURN_NONE;}
+    return PyLong_FromLong(found);
+
+release_rates_and_mutex_handler:
+    free(ratesBuf);
+    Py_XDECREF(pyoSeq);
 release_mutex_handler:
     pthread_mutex_unlock(&(mdev->instanceLock));
     return NULL;
 }
 
+// msplink.Parser: the link's frame parser on its own, for bytes that come from somewhere else
+typedef struct {
+    PyObject_HEAD
+    mspparser_t parser;
+    uint8_t buf[READ_BUFFER_SIZE];
+    mspbufpool_t pool;              // for bigger payloads, like the link's
+    unsigned long long frames;
+    unsigned long long checksum_errors;
+    unsigned long long discarded_bytes;
+    unsigned long long resyncs;
+    unsigned long long resync_skipped_bytes;
+} pyMspParserObject;
+
+static PyObject *pyMspParserNew(PyTypeObject *type, PyObject __attribute__((__unused__)) *args, PyObject __attribute__((__unused__)) *kwargs) {
+
+    // tp_alloc() zeroes the object, which leaves the pool empty
+    pyMspParserObject* self = (pyMspParserObject*)type->tp_alloc(type, 0);
+    if (self == NULL) {return NULL;}
+
+    mspparser_init(&(self->parser), self->buf, READ_BUFFER_SIZE, &(self->pool));
+
+    return (PyObject*)self;
+}
+
+static void pyMspParserDealloc(pyMspParserObject *self) {
+    mspparser_reset(&(self->parser));
+    bufpool_free(&(self->pool));
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+/**
+ *  Parses the next chunk of a byte stream
+ *
+ *  Takes any bytes-like object and returns a list of the frames it completed, as
+ *  MspPacketType objects, in order. A frame may be split across any number of calls.
+ *  NACKs are returned like other frames, with '!' as the direction. Frames with a bad
+ *  checksum are dropped and counted, and the bytes after their '$' searched again, so a
+ *  corrupted length can't take the frames behind it down too. A frame there is no memory
+ *  for is dropped the same way, and the rest of the chunk is still parsed.
+ */
+static PyObject *pyMspParserFeed(pyMspParserObject *self, PyObject *args) {
+
+    Py_buffer data;
+    PyObject* packets = NULL;
+    PyObject* packet = NULL;
+    mspPacket_t pkt;
+    size_t offset = 0;
+    size_t used = 0;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, "y*:feed", &data)) {return NULL;}
+
+    packets = PyList_New(0);
+    if (packets == NULL) {goto release_buffer_handler;}
+
+    while (offset < (size_t)data.len || mspparser_pending(&(self->parser))) {
+        ret = mspparser_feed(&(self->parser), (uint8_t*)data.buf + offset, data.len - offset, &used, &pkt);
+        offset += used;
+
+        switch (ret) {
+            case MSP_OK:
+            case MSP_RX_CLIENT_NACK:
+                self->frames++;
+
+                packet = packResponse(&pkt);
+                bufpool_trim(&(self->pool));
+                if (packet == NULL) {goto release_list_handler;}
+
+                if (PyList_Append(packets, packet) != 0) {
+                    Py_DECREF(packet);
+                    goto release_list_handler;
+                }
+                Py_DECREF(packet);
+                break;
+            case MSP_RX_CHECKSUM_MISMATCH:
+                self->checksum_errors++;
+                bufpool_trim(&(self->pool));
+                break;
+            case MSP_OUT_OF_MEMORY:
+                // Dropped like a bad frame, its bytes go to discarded_bytes as they're searched again
+                bufpool_trim(&(self->pool));
+                break;
+            case MSP_RX_WOULDBLOCK:
+                break;
+            default:
+                throwError(ret);
+                goto release_list_handler;
+        }
+    }
+
+    self->discarded_bytes += self->parser.discarded;
+    self->resyncs += self->parser.resyncs;
+    self->resync_skipped_bytes += self->parser.resync_skipped;
+    self->parser.discarded = 0;
+    self->parser.resyncs = 0;
+    self->parser.resync_skipped = 0;
+
+    PyBuffer_Release(&data);
+    return packets;
+
+release_list_handler:
+    Py_DECREF(packets);
+release_buffer_handler:
+    PyBuffer_Release(&data);
+    return NULL;
+}
+
+// Forgets a partly parsed frame, e.g. after a gap in the input
+static PyObject *pyMspParserReset(pyMspParserObject *self, PyObject __attribute__((__unused__)) *always_null) {
+    mspparser_reset(&(self->parser));
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef mspParserMethods[] =
+{
+    { "feed", (PyCFunction)pyMspParserFeed, METH_VARARGS,
+      "Parses the next chunk of input and returns a list of the frames it completed"},
+    { "reset", (PyCFunction)pyMspParserReset, METH_NOARGS,
+      "Forgets a partly parsed frame"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMemberDef mspParserMembers[] =
+{
+    { "frames", T_ULONGLONG, offsetof(pyMspParserObject, frames), READONLY,
+      "frames parsed with a good checksum, NACKs included"},
+    { "checksum_errors", T_ULONGLONG, offsetof(pyMspParserObject, checksum_errors), READONLY,
+      "frames dropped for a bad checksum"},
+    { "discarded_bytes", T_ULONGLONG, offsetof(pyMspParserObject, discarded_bytes), READONLY,
+      "input that wasn't part of any frame"},
+    { "resyncs", T_ULONGLONG, offsetof(pyMspParserObject, resyncs), READONLY,
+      "bad frames whose bytes were searched again for a frame start"},
+    { "resync_skipped_bytes", T_ULONGLONG, offsetof(pyMspParserObject, resync_skipped_bytes), READONLY,
+      "bytes those searches threw away, also counted in discarded_bytes"},
+    {NULL, 0, 0, 0, NULL}
+};
+
+static PyTypeObject pyMspParserType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "msplink.Parser",
+    .tp_doc = "Incremental MSP frame parser for input from anywhere, such as captures or other transports",
+    .tp_basicsize = sizeof(pyMspParserObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = pyMspParserNew,
+    .tp_dealloc = (destructor)pyMspParserDealloc,
+    .tp_methods = mspParserMethods,
+    .tp_members = mspParserMembers,
+};
+
 static PyMethodDef msplinkMethods[] =
 {
     { "open", (PyCFunction)pyMsplinkOpen, METH_VARARGS | METH_KEYWORDS,
@@ -552,6 +1558,20 @@ static PyMethodDef msplinkMethods[] =
       "Sends data to the MSP device"},
     { "get", (PyCFunction)pyMsplinkGet, METH_VARARGS | METH_KEYWORDS,
       "Gets data from the MSP device"},
+    { "info", (PyCFunction)pyMsplinkInfo, METH_NOARGS,
+      "Describes the open MSP connection and the tunings in effect"},
+    { "stats", (PyCFunction)pyMsplinkStats, METH_NOARGS,
+      "Returns the MSP connection statistics"},
+    { "rtt", (PyCFunction)pyMsplinkRtt, METH_VARARGS | METH_KEYWORDS,
+      "Returns the round-trip time estimate for a command"},
+    { "probe", (PyCFunction)pyMsplinkProbe, METH_VARARGS | METH_KEYWORDS,
+      "Finds and switches to the baud rate the MSP device answers at"},
+    { "fileno", (PyCFunction)pyMsplinkFileno, METH_NOARGS,
+      "Returns the file descriptor to watch for responses in an event loop"},
+    { "send_request", (PyCFunction)pyMsplinkSendRequest, METH_VARARGS | METH_KEYWORDS,
+      "Sends a request to the MSP device without waiting for the response"},
+    { "poll_response", (PyCFunction)pyMsplinkPollResponse, METH_NOARGS,
+      "Returns the next complete response, or None without waiting"},
     {NULL, NULL, 0, NULL}
 };
 
@@ -583,7 +1603,12 @@ PyMODINIT_FUNC PyInit_msplink(void) {
     mspDevice.device_open = 0;
     mspDevice.fd = 0;
     mspDevice.devname = NULL;
+    mspDevice.sysfs_root = NULL;
+    mspDevice.transport = &msptransport_serial;
+    mspDevice.baudrate = MSP_BAUDRATE_DEFAULT;
     mspDevice.read_retries = MSP_RETRY_DEFAULT;
+    mspDevice.timeout_us = MSP_RETRY_DEFAULT * MSP_RETRY_PERIOD_US;
+    mspDevice.byte_timeout_us = MSP_BYTE_TIMEOUT_DEFAULT_US;
     mspDevice.mspversion = 1;
     mspDevice.errornum = 0;
 
@@ -654,6 +1679,8 @@ PyMODINIT_FUNC PyInit_msplink(void) {
     PyStructSequence_InitType(&pyMspPacketTypeStore, &mspPacketDesc);
     pyMspPacketType = &pyMspPacketTypeStore;
 
+    if (PyType_Ready(&pyMspParserType) < 0) {goto setup_error;}
+
     // Create module object and make exceptions accessible from the interpreter
     msplinkModule = PyModule_Create(&msplink_definition);
     if (msplinkModule == NULL) {goto setup_error;}
@@ -664,6 +1691,9 @@ PyMODINIT_FUNC PyInit_msplink(void) {
     if (PyModule_AddObject(msplinkModule, "NACK", MspExc_NACK) < 0) {goto setup_error;}
     if (PyModule_AddObject(msplinkModule, "BadChecksum", MspExc_BadChecksum) < 0) {goto setup_error;}
 
+    Py_INCREF(&pyMspParserType);
+    if (PyModule_AddObject(msplinkModule, "Parser", (PyObject*)&pyMspParserType) < 0) {goto setup_error;}
+
     return msplinkModule;
 
 
@@ -18,22 +18,181 @@ along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <pthread.h>
 
 #define READ_BUFFER_SIZE 1024
+#define MSP_PAYLOAD_MAX 65535                   // largest payload a V2 or JUMBO frame can carry
+#define MSP_FRAME_OVERHEAD 16                   // room for the most header and checksum bytes a frame can wrap its payload in
+#define MSP_FRAME_MAX (MSP_PAYLOAD_MAX + MSP_FRAME_OVERHEAD)
+#define MSP_POOL_CLASSES 3                      // buffer sizes for frames over READ_BUFFER_SIZE, see bufpool.c
+#define RX_RING_SIZE 4096                       // must be a power of two
 #define MSP_RETRY_DEFAULT 3
+#define MSP_RETRY_PERIOD_US 100000              // response timeout per read_retries count, if timeout isn't given
+#define MSP_BYTE_TIMEOUT_DEFAULT_US 100000
+#define MSP_BAUDRATE_DEFAULT 115200
+#define MSP_PROBE_TIMEOUT_DEFAULT_US 20000      // per candidate rate in probe()
+#define MSP_SYSFS_ROOT_DEFAULT "/sys"
+#define MSP_NO_DEADLINE (-1)                    // transaction bounded by the link timeouts alone
+#define MSP_RTT_SLOTS 64                        // per-command RTT estimates kept, must be a power of two
+#define MSP_RECONNECT_TIMEOUT_DEFAULT_US 5000000 // how long a call waits for a lost device to come back
+#define MSP_RECONNECT_BACKOFF_MIN_US 10000      // first pause between reopen attempts
+#define MSP_RECONNECT_BACKOFF_MAX_US 500000
+#define MSP_PENDING_MAX 16                      // requests send_request() can leave outstanding for poll_response() to match
+#define MSP_MATCH_PENDING (-1)                  // rx_command for a response to any of them
+
+#define MSP_API_VERSION 1                       // command probe() sends, every MSP responder answers it
+
+// Receive ring filled by large read()s and drained by the parser.
+// head and tail count bytes forever and are masked on access, so head-tail is always the fill level.
+typedef struct {
+    uint8_t data[RX_RING_SIZE];
+    size_t head;                // next byte written by read()
+    size_t tail;                // next byte handed to the parser
+} rxring_t;
+
+// Frame buffers for large frames, allocated on demand (see bufpool.c)
+typedef struct {
+    uint8_t* block[MSP_POOL_CLASSES];   // one per size class, NULL until needed
+} mspbufpool_t;
+
+// Resumable frame parser state, fed whatever input is at hand (see parse.c)
+typedef struct {
+    int state;                  // enum MSP_PARSER_STATES
+    char version;
+    char direction;
+    int v2_in_v1;               // V2 frame tunneled in a V1 one: only the V2 checksum counts
+    uint8_t header[5];
+    size_t header_len;          // header bytes collected so far
+    uint8_t flag;
+    uint16_t function;
+    uint16_t payload_size;
+    size_t payload_len;         // payload bytes collected so far
+    uint8_t checksum;           // running checksum
+    uint8_t* base;              // storage for frames that fit it
+    size_t basesize;
+    mspbufpool_t* pool;         // where bigger frames go, or NULL to refuse them
+    uint8_t* buf;               // the current frame as received, from its '$' on
+    size_t frame_len;           // bytes of it so far
+    uint8_t* replay;            // bytes after a failed frame's '$', parsed again ahead of new input
+    size_t replay_len;
+    size_t replay_pos;          // next one to parse
+    int replaying;              // the bytes being parsed come from replay
+    int rescan;                 // the frame just failed and its bytes still need queueing for replay
+    uint64_t discarded;         // bytes skipped looking for '$', for the owner to collect
+    uint64_t resyncs;           // times a failed frame was rescanned, likewise
+    uint64_t resync_skipped;    // bytes of failed frames the rescans skipped, also counted in discarded
+} mspparser_t;
+
+// Link statistics, reset on open()
+typedef struct {
+    uint64_t tx_frames;
+    uint64_t rx_frames;                 // complete frames with a good checksum, NACKs included
+    uint64_t rx_timeouts;
+    uint64_t rx_checksum_errors;
+    uint64_t rx_discarded_bytes;        // stale or unsynchronized input thrown away by the parser
+    uint64_t rx_resyncs;                // bad or stalled frames whose bytes were searched again for a frame start
+    uint64_t rx_resync_skipped_bytes;   // bytes those searches skipped, part of rx_discarded_bytes
+    uint64_t rx_flushes;                // tcflush() calls made before requests
+    uint64_t rx_dropped_datagrams;      // UDP datagrams that didn't hold one valid frame
+    uint64_t rx_overruns;               // UART FIFO overruns, from TIOCGICOUNT
+    uint64_t rx_framing_errors;
+    uint64_t rx_parity_errors;
+    uint64_t rx_breaks;
+    uint64_t rx_buffer_overruns;        // tty buffer overruns, input lost above the driver
+    uint64_t tx_retries;                // requests sent again by the retry policy
+    uint64_t retry_recoveries;          // transactions that succeeded on a retry
+    uint64_t retries_exhausted;         // transactions that still failed when the retries ran out
+    uint64_t rx_echo_frames;            // our own requests heard back on a half-duplex link and skipped
+    uint64_t rx_unmatched_frames;       // good frames that didn't answer the request being waited on, skipped
+    uint64_t tx_queue_peak;             // most request bytes seen still queued in the driver (TIOCOUTQ)
+    uint64_t link_drops;                // times the device went away under an open link
+    uint64_t reconnects;                // times it was reopened
+    uint64_t downtime_us;               // time spent between the two, not counting a current outage
+} mspstats_t;
+
+// UART error counters as the driver keeps them (TIOCGICOUNT), counting since boot
+typedef struct {
+    uint32_t overrun;
+    uint32_t frame;
+    uint32_t parity;
+    uint32_t brk;
+    uint32_t buf_overrun;
+} msplinecount_t;
+
+// Round-trip time estimate for one command, see rtt.c
+typedef struct {
+    uint16_t command;
+    uint8_t valid;
+    int32_t srtt_us;            // smoothed RTT
+    int32_t rttvar_us;          // RTT mean deviation
+    int32_t rto_us;             // response timeout derived from the two
+} msprtt_t;
+
+struct msptransport;            // see serial.h
+struct mspuring;                // see uring.c
 
 typedef struct {
     int fd;
     char* devname;
+    const struct msptransport* transport;   // picked from devname by msplink_open()
+    int baudrate;
     int read_retries;
+    int low_latency;            // requested at open()
+    int flow_control;           // RTS/CTS hardware flow control
+    int half_duplex;            // single-wire UART: our own requests are echoed back into RX
+    int latency_timer;          // USB-serial latency timer to set at open(), in ms, or -1 to leave it alone
+    char* sysfs_root;           // where sysfs is mounted, or NULL for MSP_SYSFS_ROOT_DEFAULT; owned, freed by close(), and used again by msplink_reconnect()
+    char* latency_timer_path;   // sysfs attribute to restore on close, or NULL
+    int saved_latency_timer;    // its value before open()
+    int flush;                  // tcflush() before each request instead of discarding stale input
+    int adaptive_timeout;       // response timeout from the per-command RTT estimates instead of timeout_us
+    int retries;                // times a failed transaction is sent again
+    int retry_backoff_us;       // pause before the first retry, doubled for each one after
+    int reconnect;              // reopen devname when the device goes away
+    int reconnect_timeout_us;   // how long one call keeps trying to reopen it
+    int link_down;              // the device went away and hasn't been reopened yet; fd is closed
+    int64_t down_since;         // CLOCK_MONOTONIC us when it went away
+    int io_uring;               // requested at open()
+    struct mspuring* uring;     // io_uring state when the fd ops run on io_uring, else NULL
+    int tunings;                // MSP_TUNINGS flags that actually took effect
+    int saved_serial_flags;     // ASYNC_* flags to restore on close
+    int timeout_us;             // max wait for the first byte of a response
+    int byte_timeout_us;        // max gap between bytes once a response has started
+    int rx_started;             // a frame has begun, so waits are bounded by byte_timeout_us
+    int64_t rx_begin;           // CLOCK_MONOTONIC us the wait for the current response began
+    int64_t rx_deadline;        // absolute CLOCK_MONOTONIC us the current response must be in by, or MSP_NO_DEADLINE
+    int64_t rx_tx_us;           // time the request still needed on the wire when the response wait began
+    int rx_nonblocking;         // msplink_rxpeek() gives up with MSP_RX_WOULDBLOCK instead of waiting
+    int rx_command;             // command the awaited response must answer, or MSP_MATCH_PENDING
+    uint16_t pending[MSP_PENDING_MAX];  // commands sent by send_request() and not answered yet, oldest first
+    int pending_count;
     uint8_t buf[READ_BUFFER_SIZE];
+    rxring_t rx;
+    uint8_t* rx_spill;          // the part of a datagram that didn't fit the ring, or NULL
+    size_t rx_spill_len;
+    size_t rx_spill_pos;        // next byte handed to the parser once the ring is empty
+    mspbufpool_t rx_spill_pool; // where rx_spill comes from, apart from pool since the frame in it is copied there
+    mspparser_t parser;         // partial frame carried between reads
+    mspbufpool_t pool;          // payloads too big for buf
+    mspstats_t stats;
+    msprtt_t rtt[MSP_RTT_SLOTS];    // indexed by command, slot reused on collision
+    int has_linecount;          // the driver answers TIOCGICOUNT
+    msplinecount_t linecount_base;  // TIOCGICOUNT at the last look, what the next one adds to the stats from
     int mspversion;
     int device_open;
     int errornum;
     pthread_mutex_t instanceLock;
 } mspdev_t;
 
+enum MSP_TUNINGS {
+    MSP_TUNE_NO_OSYNC = 0x01,               // fd opened without O_SYNC
+    MSP_TUNE_ASYNC_LOW_LATENCY = 0x02,      // ASYNC_LOW_LATENCY set through TIOCSSERIAL
+    MSP_TUNE_TCP_NODELAY = 0x04,            // Nagle disabled on a TCP link
+    MSP_TUNE_IO_URING = 0x08,               // fd I/O goes through io_uring
+    MSP_TUNE_LATENCY_TIMER = 0x10           // USB-serial latency timer set through sysfs
+};
+
 enum MSP_ERRORS {
     MSP_OK = 0,
     MSP_SYSCALL_FAIL = -1,
@@ -43,5 +202,6 @@ enum MSP_ERRORS {
     MSP_RX_SYNC_NOT_FOUND = -5,
     MSP_RX_CHECKSUM_MISMATCH = -6,
     MSP_OUT_OF_MEMORY = -7,
-    MSP_RX_CLIENT_NACK = -8
+    MSP_RX_CLIENT_NACK = -8,
+    MSP_RX_WOULDBLOCK = -9              // non-blocking read ran out of buffered input
 };
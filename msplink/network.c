@@ -0,0 +1,314 @@
+/*
+This file is part of python-msptools.
+
+Python-msptools is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Python-msptools is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "network.h"
+#include "serial.h"
+#include "msplink.h"
+
+// Private functions
+
+/**
+ *  Split "host:port" (or "[v6addr]:port") into its parts
+ *
+ *  @param mdev     [in]    an MSP device pointer, for error reporting
+ *  @param address  [in]    the device name with its scheme prefix already skipped
+ *  @param host     [out]   buffer for the host part
+ *  @param hostlen  [in]    size of the host buffer
+ *  @param port     [out]   the port part, pointing into address
+ *
+ *  Returns MSP_OK, or MSP_SYSCALL_FAIL with EINVAL if the address is malformed.
+ *
+ */
+int split_address(mspdev_t* mdev, const char* address, char* host, size_t hostlen, const char** port) {
+
+    const char* host_start = address;
+    const char* host_end;
+    const char* colon = strrchr(address, ':');
+
+    if (colon == NULL || colon[1] == '\0') {goto malformed;}
+
+    host_end = colon;
+
+    if (address[0] == '[') {
+        host_start = address + 1;
+        host_end = strchr(address, ']');
+        if (host_end == NULL || host_end + 1 != colon) {goto malformed;}
+    }
+
+    if (host_end <= host_start || (size_t)(host_end - host_start) >= hostlen) {goto malformed;}
+
+    memcpy(host, host_start, host_end - host_start);
+    host[host_end - host_start] = '\0';
+    *port = colon + 1;
+
+    return MSP_OK;
+
+malformed:
+    mdev->errornum = EINVAL;
+    return MSP_SYSCALL_FAIL;
+}
+
+/**
+ *  Connect mdev->fd, giving up at the deadline
+ *
+ *  @param mdev     [in]    an MSP device pointer, fd is a fresh socket
+ *  @param ai       [in]    the address to connect to
+ *  @param deadline [in]    absolute CLOCK_MONOTONIC time in microseconds, or MSP_NO_DEADLINE
+ *
+ *  A TCP connect to a peer that drops SYNs would otherwise block for the kernel's
+ *  own connect timeout, which can be minutes. So with a deadline the socket is
+ *  non-blocking while it connects, and put back to blocking for fd_writev() after.
+ *
+ *  Returns MSP_OK, or MSP_SYSCALL_FAIL with ETIMEDOUT at the deadline.
+ */
+int connect_until(mspdev_t* mdev, const struct addrinfo* ai, int64_t deadline) {
+
+    int err = 0;
+    socklen_t errlen = sizeof(err);
+    int ret;
+
+    if (deadline == MSP_NO_DEADLINE) {
+        if (connect(mdev->fd, ai->ai_addr, ai->ai_addrlen) == 0) {return MSP_OK;}
+        mdev->errornum = errno;
+        return MSP_SYSCALL_FAIL;
+    }
+
+    if (connect(mdev->fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+        if (errno != EINPROGRESS) {
+            mdev->errornum = errno;
+            return MSP_SYSCALL_FAIL;
+        }
+
+        ret = fd_poll(mdev, POLLOUT, deadline);
+        if (ret == 0) {
+            mdev->errornum = ETIMEDOUT;
+            return MSP_SYSCALL_FAIL;
+        }
+
+        // A refused or unreachable connect may only show up as POLLERR, SO_ERROR says which
+        if (getsockopt(mdev->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) != 0) {err = errno;}
+        if (err == 0 && ret<0) {err = mdev->errornum;}
+        if (err != 0) {
+            mdev->errornum = err;
+            return MSP_SYSCALL_FAIL;
+        }
+    }
+
+    if (fcntl(mdev->fd, F_SETFL, fcntl(mdev->fd, F_GETFL) & ~O_NONBLOCK) != 0) {
+        mdev->errornum = errno;
+        return MSP_SYSCALL_FAIL;
+    }
+
+    return MSP_OK;
+}
+
+/**
+ *  Resolve host:port and connect a socket of the given type to the first address that works
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param address  [in]    the device name with its scheme prefix already skipped
+ *  @param socktype [in]    SOCK_STREAM or SOCK_DGRAM
+ *  @param deadline [in]    absolute CLOCK_MONOTONIC time in microseconds, or MSP_NO_DEADLINE
+ *
+ *  The connects end at the deadline, but the getaddrinfo() lookup before them
+ *  blocks for as long as the resolver takes.
+ *
+ */
+int connect_address(mspdev_t* mdev, const char* address, int socktype, int64_t deadline) {
+
+    char host[256];
+    const char* port;
+    struct addrinfo hints;
+    struct addrinfo* results;
+    struct addrinfo* ai;
+    int ret;
+
+    ret = split_address(mdev, address, host, sizeof(host), &port);
+    if (ret<0) {return ret;}
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+
+    ret = getaddrinfo(host, port, &hints, &results);
+    if (ret != 0) {
+        mdev->errornum = (ret == EAI_SYSTEM) ? errno : EHOSTUNREACH;
+        return MSP_SYSCALL_FAIL;
+    }
+
+    mdev->fd = -1;
+    mdev->errornum = ECONNREFUSED;
+
+    for (ai = results; ai != NULL; ai = ai->ai_next) {
+        mdev->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC | ((deadline != MSP_NO_DEADLINE) ? SOCK_NONBLOCK : 0),
+                          ai->ai_protocol);
+        if (mdev->fd < 0) {
+            mdev->errornum = errno;
+            continue;
+        }
+
+        if (connect_until(mdev, ai, deadline) == MSP_OK) {break;}
+
+        close(mdev->fd);
+        mdev->fd = -1;
+    }
+
+    freeaddrinfo(results);
+
+    if (mdev->fd < 0) {return MSP_SYSCALL_FAIL;}
+
+    return MSP_OK;
+}
+
+// Public interface
+
+/**
+ *  Connect to an MSP responder listening on a TCP port
+ *
+ *  @param mdev     [in]    an MSP device pointer, devname is "tcp://host:port"
+ *  @param deadline [in]    absolute CLOCK_MONOTONIC time in microseconds, or MSP_NO_DEADLINE
+ *
+ *  Every address the host resolves to is tried in turn. TCP_NODELAY is set
+ *  so each request frame goes out immediately instead of waiting on Nagle.
+ *
+ */
+int tcp_open(mspdev_t* mdev, int64_t deadline) {
+
+    int one = 1;
+    int ret;
+
+    ret = connect_address(mdev, mdev->devname + strlen(MSP_TCP_PREFIX), SOCK_STREAM, deadline);
+    if (ret<0) {return ret;}
+
+    if (setsockopt(mdev->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == 0) {
+        mdev->tunings |= MSP_TUNE_TCP_NODELAY;
+    }
+
+    return MSP_OK;
+}
+
+/**
+ *  Set up a UDP link to an MSP bridge that carries one frame per datagram
+ *
+ *  @param mdev     [in]    an MSP device pointer, devname is "udp://host:port"
+ *  @param deadline [in]    absolute CLOCK_MONOTONIC time in microseconds, or MSP_NO_DEADLINE
+ *
+ *  The socket is connected so that writes go to the bridge and only the
+ *  bridge's datagrams are received.
+ *
+ */
+int udp_open(mspdev_t* mdev, int64_t deadline) {
+    return connect_address(mdev, mdev->devname + strlen(MSP_UDP_PREFIX), SOCK_DGRAM, deadline);
+}
+
+/**
+ *  Receive one datagram
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param iov      [out]   where to put the datagram
+ *  @param iovcnt   [in]    number of iov entries
+ *
+ *  Returns the datagram length, 0 if nothing usable was pending, or
+ *  MSP_SYSCALL_FAIL. A datagram too big for iov can't hold a frame we could
+ *  parse, so it is dropped (and counted) here rather than handed up cut short.
+ *
+ */
+ssize_t udp_read(mspdev_t* mdev, struct iovec* iov, int iovcnt) {
+
+    struct msghdr msg;
+    ssize_t ret;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    ret = recvmsg(mdev->fd, &msg, MSG_DONTWAIT);
+
+    if (ret<0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {return 0;}
+        mdev->errornum = errno;
+        return MSP_SYSCALL_FAIL;
+    }
+
+    if (msg.msg_flags & MSG_TRUNC) {
+        mdev->stats.rx_dropped_datagrams++;
+        return 0;
+    }
+
+    return ret;
+}
+
+// tcflush() doesn't apply to sockets, so read and drop whatever is queued instead
+int network_flush(mspdev_t* mdev) {
+
+    uint8_t scratch[512];
+    ssize_t ret;
+
+    for (;;) {
+        ret = recv(mdev->fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+
+        if (ret > 0) {continue;}
+        if (ret == 0 && mdev->transport->datagram) {continue;}      // empty datagram
+        if (ret == 0) {return MSP_OK;}      // peer closed, the next read will report it
+        if (errno == EINTR) {continue;}
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {return MSP_OK;}
+
+        mdev->errornum = errno;
+        return MSP_SYSCALL_FAIL;
+    }
+}
+
+const msptransport_t msptransport_tcp = {
+    .name = "tcp",
+    .prefix = MSP_TCP_PREFIX,
+    .datagram = 0,
+    .open = tcp_open,
+    .close = fd_close,
+    .read = fd_read,
+    .writev = fd_writev,
+    .wait = fd_wait,
+    .drain = NULL,
+    .outq = NULL,
+    .flush = network_flush,
+    .bytesavailable = fd_bytesavailable
+};
+
+const msptransport_t msptransport_udp = {
+    .name = "udp",
+    .prefix = MSP_UDP_PREFIX,
+    .datagram = 1,
+    .open = udp_open,
+    .close = fd_close,
+    .read = udp_read,
+    .writev = fd_writev,
+    .wait = fd_wait,
+    .drain = NULL,
+    .outq = NULL,
+    .flush = network_flush,
+    .bytesavailable = fd_bytesavailable
+};
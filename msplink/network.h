@@ -0,0 +1,27 @@
+/*
+This file is part of python-msptools.
+
+Python-msptools is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Python-msptools is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "msplink.h"
+
+#include "serial.h"
+
+#define MSP_TCP_PREFIX "tcp://"
+#define MSP_UDP_PREFIX "udp://"
+
+// The transports themselves, msptransport_tcp and msptransport_udp, are declared in serial.h
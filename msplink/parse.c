@@ -18,173 +18,624 @@ along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
 
 /*
 Assumptions:
-- Once a packet has started transmission, all inter-byte spacing will be less than 0.1 seconds
+- Once a packet has started transmission, all inter-byte spacing will be less than mdev->byte_timeout_us
 */
 
 #include <stdint.h>
-#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "parse.h"
 #include "msplink.h"
 #include "serial.h"
 #include "checksums.h"
+#include "bufpool.h"
 
-#define MAX_SYNC_SEARCH_BYTES 50                // Number of bytes to search for sync before giving up
+/**
+ *  Set up a frame parser
+ *
+ *  @param p        [in]    the parser
+ *  @param buf      [in]    where frames are stored, at least MSP_FRAME_OVERHEAD bytes
+ *  @param bufsize  [in]    its size in bytes
+ *  @param pool     [in]    buffer pool for frames bigger than bufsize, or NULL to report them as MSP_OUT_OF_MEMORY
+ *
+ *  A frame taken from the pool stays valid until the owner calls bufpool_trim() or the next frame starts.
+ *  mspparser_reset() releases what the parser allocates itself.
+ *
+ */
+void mspparser_init(mspparser_t* p, uint8_t* buf, size_t bufsize, mspbufpool_t* pool) {
+    p->base = buf;
+    p->basesize = bufsize;
+    p->pool = pool;
+    p->buf = buf;
+    p->replay = NULL;
+    p->discarded = 0;
+    p->resyncs = 0;
+    p->resync_skipped = 0;
+    mspparser_reset(p);
+}
+
+// Forget the bytes queued for another look
+void parser_dropreplay(mspparser_t* p) {
+    free(p->replay);
+    p->replay = NULL;
+    p->replay_len = 0;
+    p->replay_pos = 0;
+}
+
+// Drop any partial frame and go back to looking for a sync byte
+void mspparser_reset(mspparser_t* p) {
+    p->state = MSP_PARSE_SYNC;
+    p->frame_len = 0;
+    p->replaying = 0;
+    p->rescan = 0;
+    parser_dropreplay(p);
+}
+
+// Whether the parser is inside a frame, past its '$M' or '$X' preamble
+int parser_inframe(const mspparser_t* p) {
+    return (p->state != MSP_PARSE_SYNC && p->state != MSP_PARSE_VERSION);
+}
+
+// Whether bytes of a failed frame are waiting to be parsed again, so mspparser_feed() has input
+// even when the caller has none
+int mspparser_pending(const mspparser_t* p) {
+    return (p->replay_pos < p->replay_len);
+}
+
+// Bytes thrown away while looking for '$'
+void parser_skip(mspparser_t* p, size_t n) {
+    p->discarded += n;
+    if (p->replaying) {p->resync_skipped += n;}
+}
 
-// Rx buffer should have been flushed before TX, so there shouldn't be much to weed through.
-int get_sync(mspdev_t* mdev) {
+// The current frame is no good. Its '$' is dropped, and whatever followed it is parsed
+// again once the caller is back in mspparser_feed(), in case a frame start hides in there.
+void parser_fail(mspparser_t* p) {
+    p->state = MSP_PARSE_SYNC;
+    p->rescan = 1;
+    p->resyncs++;
+    p->discarded++;
+    p->resync_skipped++;
+}
+
+// Queue the failed frame's bytes after its '$' ahead of any input not yet parsed.
+// A frame that started inside the replay is still there, so stepping back is enough.
+void parser_rescan(mspparser_t* p) {
 
-    int ret=0;
-    uint8_t buf;
+    size_t n = p->frame_len - 1;
 
-    for (int i=0; i < MAX_SYNC_SEARCH_BYTES; i++) {
+    p->rescan = 0;
+
+    if (p->replaying) {
+        p->replay_pos -= n;
+        return;
+    }
 
-        ret = msplink_read(mdev, &buf, 1);      // Note: If the retry count in msplink_read() is exhausted
+    // Anything left in the replay was used up before new input was taken
+    parser_dropreplay(p);
 
-        // Bail if no bytes are available after mdev->read_retries
-        // This should prevent excessive time-wasting when no bytes are showing up.
-        if (ret == MSP_RX_FAIL) {break;}        // Special case, the error MSP_RX_SYNC_NOT_FOUND is more informative to user.
-        else if (ret<0)         {return ret;}   // Something worse happened!
-                                                
-        if (buf == '$')
-            return MSP_OK;
+    p->replay = malloc(n);
+    if (p->replay == NULL) {
+        p->discarded += n;
+        p->resync_skipped += n;
+        return;
     }
 
-    return MSP_RX_SYNC_NOT_FOUND;
+    memcpy(p->replay, p->buf + 1, n);
+    p->replay_len = n;
 }
 
 /**
- *  MSP V2 packet parser
+ *  Give up on a partial frame and rescan its bytes
  *
- *  @param mdev     [in]    an MSP device pointer
- *  @param response [out]   an MSP packet pointer to hold returned data
+ *  @param p        [in]    the parser
  *
- *  @warning Do not call this function directly.
- *
- *  -At this point sync byte, MSP version char, and direction char are consumed {'$', ['M', 'X'], ['<','!']}
- *  -Read flag, function, payload_size fields
- *  -Determine if payload is too big
- *  -Read payload and checksum
- *  -Calculate checksum and compare
+ *  For the owner to call when the input stops partway through a frame, which may only be
+ *  waiting for more because a corrupted length byte made it look longer than it is.
  *
  */
-int parse_V2(mspdev_t* mdev, mspPacket_t* pkt) {
-    int ret = 0;
+void mspparser_resync(mspparser_t* p) {
+    if (!parser_inframe(p)) {return;}
 
-    uint8_t checksum = 0;
+    parser_fail(p);
+    parser_rescan(p);
+}
 
-    union {
-        uint8_t bytes[5];
-        struct {
-            uint8_t flag;
-            uint16_t function;
-            uint16_t payload_size;
-        } __attribute__((packed)) values;
-    } buffer;
+// The header is complete: find room for the whole frame, then collect the payload
+int parser_begin_payload(mspparser_t* p) {
 
-    ret = msplink_read(mdev, buffer.bytes, 5);
-    if (ret<0) {return ret;}
+    size_t size = p->frame_len + p->payload_size + 1;
+    uint8_t* buf;
 
-    checksum = checksum_crc8_dvb_s2(buffer.bytes, 5, 0);
+    if (size > p->basesize) {
+        buf = (p->pool != NULL) ? bufpool_get(p->pool, size) : NULL;
 
-    pkt->flag = buffer.values.flag;
-    pkt->function = le16toh(buffer.values.function);
-    pkt->payload_size = le16toh(buffer.values.payload_size);
+        if (buf == NULL) {
+            parser_fail(p);
+            return MSP_OUT_OF_MEMORY;
+        }
 
-    if (pkt->payload_size > READ_BUFFER_SIZE-1) {
-        // TODO: dynamically allocate buffer
-        return MSP_OUT_OF_MEMORY;
+        memcpy(buf, p->buf, p->frame_len);
+        p->buf = buf;
     }
 
-    ret = msplink_read(mdev, mdev->buf, pkt->payload_size+1);
-    if (ret<0) {return ret;}
+    p->payload_len = 0;
+    p->state = (p->payload_size > 0) ? MSP_PARSE_PAYLOAD : MSP_PARSE_CHECKSUM;
+    return MSP_RX_WOULDBLOCK;
+}
+
+// The V1 header is complete. If function == 0xff, the payload is a V2 frame, and only its
+// own checksum is checked.
+int parser_v1_body(mspparser_t* p) {
+    if (p->function == 0xff) {
+        p->v2_in_v1 = 1;
+        p->header_len = 0;
+        p->state = MSP_PARSE_V2_HEADER;
+        return MSP_RX_WOULDBLOCK;
+    }
+
+    return parser_begin_payload(p);
+}
 
-    pkt->payload = mdev->buf;
-    pkt->checksum = mdev->buf[pkt->payload_size];
+// The checksum byte is in: describe the frame in pkt and say how it went
+int parser_finish(mspparser_t* p, uint8_t checksum, mspPacket_t* pkt) {
+    pkt->version = p->version;
+    pkt->direction = p->direction;
+    pkt->flag = p->flag;
+    pkt->function = p->function;
+    pkt->payload_size = p->payload_size;
+    pkt->payload = p->buf + p->frame_len - 1 - p->payload_size;
+    pkt->checksum = checksum;
+
+    if (checksum != p->checksum) {
+        parser_fail(p);
+        return MSP_RX_CHECKSUM_MISMATCH;
+    }
+
+    // A tunneled V2 frame is still followed by the V1 checksum
+    p->state = p->v2_in_v1 ? MSP_PARSE_V1_TRAILER : MSP_PARSE_SYNC;
+
+    if (p->direction == MSP_DIR_ERROR)  {return MSP_RX_CLIENT_NACK;}
+
+    return MSP_OK;
+}
 
-    checksum = checksum_crc8_dvb_s2(mdev->buf, pkt->payload_size, checksum);
+// One pass of the state machine over data, see mspparser_feed()
+int parser_run(mspparser_t* p, const uint8_t* data, size_t len, size_t* used, mspPacket_t* pkt) {
+
+    int ret = MSP_RX_WOULDBLOCK;
+    size_t i = 0;
+    size_t chunk;
+    const uint8_t* sync;
+    uint8_t c;
+
+    while (i < len && ret == MSP_RX_WOULDBLOCK) {
+        switch (p->state) {
+            case MSP_PARSE_SYNC:            // memchr() is vectorized, so noise costs next to nothing
+                sync = memchr(data + i, '$', len - i);
+                chunk = (sync != NULL) ? (size_t)(sync - (data + i)) : len - i;
+
+                parser_skip(p, chunk);
+                i += chunk;
+
+                if (sync != NULL) {
+                    i++;
+                    p->buf = p->base;
+                    p->buf[0] = '$';
+                    p->frame_len = 1;
+                    p->state = MSP_PARSE_VERSION;
+                }
+                break;
+
+            case MSP_PARSE_VERSION:
+                c = data[i];
+
+                // Not a frame after all. The '$' was noise, and this byte gets another look
+                // as a sync byte itself.
+                if (c != MSP_V1 && c != MSP_V2) {
+                    parser_skip(p, 1);
+                    p->state = MSP_PARSE_SYNC;
+                    break;
+                }
+
+                i++;
+                p->buf[p->frame_len++] = c;
+                p->version = c;
+                p->state = MSP_PARSE_DIRECTION;
+                break;
+
+            case MSP_PARSE_DIRECTION:
+                c = data[i];
+
+                // Same again: a real frame has one of three, and this byte gets another look
+                if (c != MSP_DIR_TOCLIENT && c != MSP_DIR_TOHOST && c != MSP_DIR_ERROR) {
+                    parser_skip(p, 2);
+                    p->state = MSP_PARSE_SYNC;
+                    break;
+                }
+
+                i++;
+                p->buf[p->frame_len++] = c;
+                p->direction = c;
+                p->v2_in_v1 = 0;
+                p->flag = 0;        // V1 has no flag field
+                p->header_len = 0;
+                p->state = (p->version == MSP_V1) ? MSP_PARSE_V1_HEADER : MSP_PARSE_V2_HEADER;
+                break;
+
+            case MSP_PARSE_V1_HEADER:       // payload size, command
+                c = data[i++];
+                p->buf[p->frame_len++] = c;
+                p->header[p->header_len++] = c;
+                if (p->header_len < 2) {break;}
+
+                p->checksum = checksum_xor(p->header, 2, 0);
+                p->payload_size = p->header[0];
+                p->function = p->header[1];
+
+                if (p->payload_size == 0xff) {
+                    p->header_len = 0;
+                    p->state = MSP_PARSE_V1_JUMBO;
+                }
+                else {
+                    ret = parser_v1_body(p);
+                }
+                break;
+
+            case MSP_PARSE_V1_JUMBO:        // actual payload size is the first two bytes of the payload
+                c = data[i++];
+                p->buf[p->frame_len++] = c;
+                p->header[p->header_len++] = c;
+                if (p->header_len < 2) {break;}
+
+                p->checksum = checksum_xor(p->header, 2, p->checksum);
+                p->payload_size = p->header[0] | (p->header[1] << 8);
+
+                ret = parser_v1_body(p);
+                break;
+
+            case MSP_PARSE_V2_HEADER:       // flag, function, payload size
+                c = data[i++];
+                p->buf[p->frame_len++] = c;
+                p->header[p->header_len++] = c;
+                if (p->header_len < 5) {break;}
+
+                p->checksum = checksum_crc8_dvb_s2(p->header, 5, 0);
+                p->flag = p->header[0];
+                p->function = p->header[1] | (p->header[2] << 8);
+                p->payload_size = p->header[3] | (p->header[4] << 8);
+
+                ret = parser_begin_payload(p);
+                break;
+
+            case MSP_PARSE_PAYLOAD:
+                chunk = p->payload_size - p->payload_len;
+                if (chunk > len - i) {chunk = len - i;}
+
+                memcpy(p->buf + p->frame_len, data + i, chunk);
+
+                if (p->version == MSP_V2 || p->v2_in_v1) {
+                    p->checksum = checksum_crc8_dvb_s2(data + i, chunk, p->checksum);
+                }
+                else {
+                    p->checksum = checksum_xor(data + i, chunk, p->checksum);
+                }
+
+                p->frame_len += chunk;
+                p->payload_len += chunk;
+                i += chunk;
+
+                if (p->payload_len == p->payload_size) {p->state = MSP_PARSE_CHECKSUM;}
+                break;
+
+            case MSP_PARSE_CHECKSUM:
+                c = data[i++];
+                p->buf[p->frame_len++] = c;
+                ret = parser_finish(p, c, pkt);
+                break;
+
+            case MSP_PARSE_V1_TRAILER:      // ignored, the V2 checksum already vouched for the frame
+                i++;
+                p->state = MSP_PARSE_SYNC;
+                break;
+
+            default:
+                p->state = MSP_PARSE_SYNC;
+                ret = MSP_LIB_INTERNAL_ERROR;
+                break;
+        }
+    }
 
-    if (pkt->checksum != checksum)
-        {return MSP_RX_CHECKSUM_MISMATCH;}
-    else
-        {return MSP_OK;}
+    *used = i;
+    return ret;
 }
 
 /**
- *  MSP V1 packet parser
+ *  Push input through the frame parser
  *
- *  @param mdev     [in]    an MSP device pointer
- *  @param response [out]   an MSP packet pointer to hold returned data
+ *  @param p        [in]    the parser
+ *  @param data     [in]    input bytes, any amount, starting wherever the last call left off
+ *  @param len      [in]    number of bytes at data, which may be 0 while mspparser_pending()
+ *  @param used     [out]   how many of them were consumed
+ *  @param pkt      [out]   the frame, once one is complete
+ *
+ *  -Skip anything before a '$M' or '$X' preamble, counting it in p->discarded
+ *  -Collect the direction character {'<', '>', '!'}, or go back to skipping if it's something else
+ *  -Collect the V1 size and command, the JUMBO size, or the V2 flag, function and size
+ *  -Collect the payload into the parser's buffer, and the checksum
  *
- *  @warning Do not call this function directly.
+ *  Stops as soon as a frame is complete and returns MSP_OK, MSP_RX_CLIENT_NACK or
+ *  MSP_RX_CHECKSUM_MISMATCH with pkt filled in; pkt->payload points into the parser's buffer
+ *  and stays valid until the next call, or until bufpool_trim() if it came from the pool. A frame too big for the buffer gives MSP_OUT_OF_MEMORY,
+ *  and the rest of the input is for the next call. MSP_RX_WOULDBLOCK means all of it was consumed without finishing a frame;
+ *  the partial frame is kept for the next call.
  *
- *  -At this point sync byte, MSP version char, and direction char are consumed {'$', ['M', 'X'], ['<','!']}
- *  -Read payload size and command byte
- *  -Determine if a JUMBO packet was received (length=255) and consume actual length from start of payload (2 bytes)
- *  -Determine if a V2 packet is encapsulated in this V1 packet (function=255) and transfer to V2 parser if so
- *  -Determine if buffer is large enough for rx data
- *  -Read payload and checksum byte
- *  -Calculate checksum and compare
+ *  A frame that fails its checksum or can't be stored may have started on a noise '$', or had its
+ *  length corrupted, and swallowed the start of a good frame. So the bytes after its '$' are parsed
+ *  again at the start of the next call, ahead of new input, and the ones skipped on the way are
+ *  counted in p->resync_skipped as well.
  *
  */
-int parse_V1(mspdev_t* mdev, mspPacket_t* pkt) {
+int mspparser_feed(mspparser_t* p, const uint8_t* data, size_t len, size_t* used, mspPacket_t* pkt) {
 
-    int ret = 0;
-    uint8_t checksum = 0;
+    size_t n;
+    int ret;
 
-    uint8_t buf[2];
+    p->replaying = 1;
 
-    union {
-        uint8_t bytes[2];
-        uint16_t value;
-    } payload_len_le;
+    while (mspparser_pending(p)) {
+        ret = parser_run(p, p->replay + p->replay_pos, p->replay_len - p->replay_pos, &n, pkt);
+        p->replay_pos += n;
 
-    pkt->flag = 0;      // V1 has no flag field
+        if (p->rescan) {parser_rescan(p);}
 
-    ret = msplink_read(mdev, buf, 2);
-    if (ret<0) {return ret;}
+        if (ret != MSP_RX_WOULDBLOCK) {
+            p->replaying = 0;
+            *used = 0;
+            return ret;
+        }
+    }
 
-    checksum = checksum_xor(buf, 2, 0);
-    pkt->payload_size = buf[0];
-    pkt->function = buf[1];
+    p->replaying = 0;
+    if (p->replay != NULL) {parser_dropreplay(p);}
 
-    if (pkt->payload_size == 0xff) {        // JUMBO packet
+    ret = parser_run(p, data, len, used, pkt);
 
-        // Actual payload size is the first two bytes of the payload
-        ret = msplink_read(mdev, payload_len_le.bytes, 2);
-        if (ret<0) {return ret;}
+    if (p->rescan) {parser_rescan(p);}
+
+    return ret;
+}
 
-        checksum = checksum_xor(payload_len_le.bytes, 2, checksum);
+// Keep the link statistics in step with what parse_packet() returns
+int tally_result(mspdev_t* mdev, int ret) {
 
-        pkt->payload_size = le16toh(payload_len_le.value);
+    switch (ret) {
+        case MSP_OK:
+        case MSP_RX_CLIENT_NACK:
+            mdev->stats.rx_frames++;
+            break;
+        case MSP_RX_FAIL:
+        case MSP_RX_SYNC_NOT_FOUND:
+            mdev->stats.rx_timeouts++;
+            break;
+        case MSP_RX_CHECKSUM_MISMATCH:
+            mdev->stats.rx_checksum_errors++;
+            break;
+        default:
+            break;
     }
 
-    // If function == 0xff, the payload is a V2 packet.
-    // if this is the case, we can just ignore the V1 checksum because the V2
-    // checksum is already checked
+    return ret;
+}
+
+// On a half-duplex link the UART hears everything we send, so our own request comes back
+// ahead of the response. A responder never sends '<' frames, so anything parsed in that
+// direction (even with a checksum garbled by bus turnaround) is the echo and gets skipped.
+// The response's first byte then gets the full response timeout again.
+int skip_echo(mspdev_t* mdev, int ret, mspPacket_t* response) {
+
+    if (!mdev->half_duplex) {return 0;}
+    if (ret != MSP_OK && ret != MSP_RX_CHECKSUM_MISMATCH) {return 0;}
+    if (response->direction != MSP_DIR_TOCLIENT) {return 0;}
 
-    if (pkt->function == 0xff) {
-        ret = parse_V2(mdev, pkt);
+    mdev->stats.rx_echo_frames++;
+    mdev->rx_started = 0;
+    mdev->rx_begin = monotonic_us();
+    return 1;
+}
+
+/**
+ *  Remember a request sent without waiting for its response
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param command  [in]    the command that was sent
+ *
+ *  parse_poll() only hands out responses to commands recorded here. When too many are
+ *  outstanding the oldest is forgotten, since its response has most likely been lost.
+ *
+ */
+void parse_expect(mspdev_t* mdev, uint16_t command) {
 
-        if (ret<0)  {return ret;}
-        else        {return MSP_OK;}
+    if (mdev->pending_count == MSP_PENDING_MAX) {
+        memmove(mdev->pending, mdev->pending + 1, (MSP_PENDING_MAX - 1) * sizeof(mdev->pending[0]));
+        mdev->pending_count--;
     }
 
-    if (pkt->payload_size > READ_BUFFER_SIZE-1) {
-        // TODO: dynamically allocate buffer
-        return MSP_OUT_OF_MEMORY;
+    mdev->pending[mdev->pending_count++] = command;
+}
+
+// Whether a good frame answers what the link is waiting for. It has to be a response in the
+// link's MSP version, to the command of the current transaction or, for parse_poll(), to the
+// oldest outstanding request with the same command, which it then settles.
+int match_response(mspdev_t* mdev, const mspPacket_t* response) {
+
+    char version = (mdev->mspversion == 1) ? MSP_V1 : MSP_V2;
+
+    if (response->version != version || response->direction == MSP_DIR_TOCLIENT) {return 0;}
+
+    if (mdev->rx_command != MSP_MATCH_PENDING) {return (response->function == mdev->rx_command);}
+
+    for (int i = 0; i < mdev->pending_count; i++) {
+        if (mdev->pending[i] != response->function) {continue;}
+
+        memmove(mdev->pending + i, mdev->pending + i + 1, (mdev->pending_count - i - 1) * sizeof(mdev->pending[0]));
+        mdev->pending_count--;
+        return 1;
     }
 
-    ret = msplink_read(mdev, mdev->buf, pkt->payload_size+1);
-    if (ret<0) {return ret;}
+    return 0;
+}
 
-    pkt->payload = mdev->buf;
-    pkt->checksum = mdev->buf[pkt->payload_size];
+/**
+ *  Read one frame from a byte stream
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param response [out]   an MSP packet pointer to hold returned data
+ *
+ *  -Push buffered input through the link's parser in place, waiting for more as the response timeouts allow
+ *  -Give up with MSP_RX_SYNC_NOT_FOUND if no frame has started by the response timeout, however much noise came first
+ *  -Once one has, the inter-byte timeout applies
+ *  -On a half-duplex link, skip the echo of the request and go again
+ *  -Skip good frames that don't answer the request, such as late responses to an earlier one
+ *  -Behind a bad frame, look through what is already buffered for a good one before reporting it
+ *  -If a frame stalls, rescan its bytes before giving up with MSP_RX_FAIL
+ *
+ *  A partial frame stays in the parser when the input runs out, so in non-blocking mode the
+ *  next call picks it up where this one stopped.
+ *
+ */
+int read_frame(mspdev_t* mdev, mspPacket_t* response) {
 
-    checksum = checksum_xor(mdev->buf, pkt->payload_size, checksum);
+    mspparser_t* parser = &mdev->parser;
+    uint8_t* data = NULL;
+    size_t used;
+    int failed = MSP_OK;        // the last frame came out bad or stalled, and nothing has started since
+    int ret = 0;
 
-    if (pkt->checksum != checksum)  {return MSP_RX_CHECKSUM_MISMATCH;}
-    else                            {return MSP_OK;}
+    for (;;) {
+        if (mspparser_pending(parser)) {
+            ret = 0;            // the parser rescans a failed frame's bytes first
+        }
+        else if (failed != MSP_OK && rxring_count(&mdev->rx) == 0) {
+            return failed;
+        }
+        else {
+            ret = msplink_rxpeek(mdev, &data);
+
+            // A frame can look longer than it is when its length byte got corrupted,
+            // so the bytes after its '$' get another look before this gives up
+            if (ret == MSP_RX_FAIL && parser_inframe(parser)) {
+                mspparser_resync(parser);
+                failed = MSP_RX_FAIL;
+                continue;
+            }
+
+            // Special case, the error MSP_RX_SYNC_NOT_FOUND is more informative to user.
+            if (ret == MSP_RX_FAIL) {return MSP_RX_SYNC_NOT_FOUND;}
+            if (ret<0) {return ret;}
+        }
+
+        ret = mspparser_feed(parser, data, ret, &used, response);
+        msplink_rxconsume(mdev, used);
+
+        mdev->stats.rx_discarded_bytes += parser->discarded;
+        mdev->stats.rx_resyncs += parser->resyncs;
+        mdev->stats.rx_resync_skipped_bytes += parser->resync_skipped;
+        parser->discarded = 0;
+        parser->resyncs = 0;
+        parser->resync_skipped = 0;
+
+        if (ret == MSP_RX_WOULDBLOCK) {
+            mdev->rx_started = parser_inframe(parser);
+
+            // A new frame overwrites the bad one, so that's the one to wait for now
+            if (mdev->rx_started) {failed = MSP_OK;}
+            continue;
+        }
+
+        if (skip_echo(mdev, ret, response)) {continue;}
+
+        if (ret == MSP_RX_CHECKSUM_MISMATCH || ret == MSP_OUT_OF_MEMORY) {
+            failed = ret;
+            continue;
+        }
+
+        // Somebody else's response, so the one we want hasn't started yet. The bad frame
+        // before it, if any, is gone from the parser's buffer and may have been stale too.
+        if ((ret == MSP_OK || ret == MSP_RX_CLIENT_NACK) && !match_response(mdev, response)) {
+            mdev->stats.rx_unmatched_frames++;
+            mdev->rx_started = 0;
+            failed = MSP_OK;
+            continue;
+        }
+
+        return ret;
+    }
+}
+
+/**
+ *  Read one frame from a datagram link
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param response [out]   an MSP packet pointer to hold returned data
+ *  @param deadline [in]    absolute CLOCK_MONOTONIC time in microseconds
+ *
+ *  Each datagram carries exactly one frame starting at its first byte, so
+ *  there is nothing to search for: a datagram that doesn't start with '$',
+ *  is cut short, or fails its checksum is dropped whole and the next one is
+ *  tried until the deadline. So is a good frame that doesn't answer the request.
+ *
+ */
+int read_datagram(mspdev_t* mdev, mspPacket_t* response, int64_t deadline) {
+
+    uint8_t* data;
+    size_t used;
+    int ret = 0;
+
+    for (;;) {
+        ret = msplink_nextdatagram(mdev, deadline);
+        if (ret<0) {return ret;}
+
+        ret = msplink_rxpeek(mdev, &data);
+        if (ret<0) {return ret;}
+
+        mspparser_reset(&mdev->parser);
+
+        if (ret >= 2 && data[0] == '$' && (data[1] == MSP_V1 || data[1] == MSP_V2)) {
+            // A datagram too big for the ring comes in two pieces
+            for (;;) {
+                ret = mspparser_feed(&mdev->parser, data, ret, &used, response);
+                msplink_rxconsume(mdev, used);
+                if (ret != MSP_RX_WOULDBLOCK) {break;}
+
+                ret = msplink_rxpeek(mdev, &data);
+                if (ret<0) {break;}         // MSP_RX_FAIL: the frame runs past the end of the datagram
+            }
+
+            msplink_dropspill(mdev);
+        }
+        else {
+            ret = MSP_RX_SYNC_NOT_FOUND;
+        }
+
+        switch (ret) {
+            case MSP_OK:
+            case MSP_RX_CLIENT_NACK:
+                if (match_response(mdev, response)) {return ret;}
+
+                mdev->stats.rx_unmatched_frames++;
+                break;
+            case MSP_RX_FAIL:
+            case MSP_RX_SYNC_NOT_FOUND:
+            case MSP_RX_CHECKSUM_MISMATCH:
+            case MSP_OUT_OF_MEMORY:
+                mdev->stats.rx_dropped_datagrams++;
+                break;
+            default:
+                return ret;
+        }
+    }
 }
 
 /**
@@ -192,44 +643,68 @@ int parse_V1(mspdev_t* mdev, mspPacket_t* pkt) {
  *
  *  @param mdev     [in]    an MSP device pointer
  *  @param response [out]   an MSP packet pointer to hold returned data
+ *  @param deadline [in]    absolute CLOCK_MONOTONIC time in microseconds the whole response must be in by, or MSP_NO_DEADLINE
+ *  @param command  [in]    the command the response must answer
  *
- *  -Block until all Tx bytes have gone out
- *  -Look for sync byte '$'
- *  -Look for MSP version character 'M' or 'X'
- *  -Split path based on MSP packet version
+ *  -Arm the response timeout, stretched by whatever part of the request is still queued for the wire
+ *  -Read one frame (from the stream, or from whole datagrams on UDP) that answers command in the link's
+ *   MSP version, and account for the outcome in the link statistics
  *
  */
-int parse_packet(mspdev_t* mdev, mspPacket_t* response) {
+int parse_packet(mspdev_t* mdev, mspPacket_t* response, int64_t deadline, uint16_t command) {
 
     int ret = 0;
-    uint8_t headbytes[2];
 
-    ret = msplink_waituntilsent(mdev);
-    if (ret<0) {return ret;}
+    msplink_beginrx(mdev, deadline);
+    mdev->rx_command = command;
 
-    ret = get_sync(mdev);
+    ret = msplink_txpending(mdev);
     if (ret<0) {return ret;}
 
-    ret = msplink_read(mdev, headbytes, 2);
-    if (ret<0) {return ret;}
+    if (mdev->transport->datagram) {
+        if (deadline == MSP_NO_DEADLINE) {deadline = monotonic_us() + mdev->timeout_us;}
+        return tally_result(mdev, read_datagram(mdev, response, deadline));
+    }
 
-    response->version = headbytes[0];       // 'X' or 'M'
-    response->direction = headbytes[1]; // '<' '>' or '!'
+    return tally_result(mdev, read_frame(mdev, response));
+}
 
-    switch (response->version) {
-        case MSP_V1:
-            ret = parse_V1(mdev, response);
-            if (ret<0) {return ret;}
-            break;
-        case MSP_V2:
-            ret = parse_V2(mdev, response);
-            if (ret<0) {return ret;}
-            break;
-        default:
-            return MSP_LIB_INTERNAL_ERROR;
+/**
+ *  Non-blocking MSP packet parser
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param response [out]   an MSP packet pointer to hold returned data
+ *
+ *  -Parse a frame out of whatever input is already available, without waiting
+ *  -If the frame is incomplete, keep it in the link's parser and return MSP_RX_WOULDBLOCK so the next call carries on with more data
+ *  -Noise with no sync byte in it is dropped as usual and also reported as MSP_RX_WOULDBLOCK
+ *  -Only responses to requests recorded with parse_expect() are returned, anything else is skipped
+ *
+ */
+int parse_poll(mspdev_t* mdev, mspPacket_t* response) {
+
+    int ret = 0;
+
+    mdev->rx_command = MSP_MATCH_PENDING;
+
+    if (mdev->transport->datagram) {
+        ret = read_datagram(mdev, response, 0);
+        if (ret == MSP_RX_FAIL) {return MSP_RX_WOULDBLOCK;}
+
+        return tally_result(mdev, ret);
     }
 
-    if (response->direction == MSP_DIR_ERROR) {return MSP_RX_CLIENT_NACK;}
+    mdev->rx_nonblocking = 1;
 
-    return MSP_OK;
+    ret = read_frame(mdev, response);
+
+    mdev->rx_nonblocking = 0;
+
+    // On io_uring the fd an event loop watches only reports input while a read is in flight,
+    // and msplink_fileno() puts one back if the frame used up the last one
+    if (ret != MSP_RX_WOULDBLOCK) {msplink_fileno(mdev);}
+
+    if (ret == MSP_RX_WOULDBLOCK || ret == MSP_RX_SYNC_NOT_FOUND) {return MSP_RX_WOULDBLOCK;}
+
+    return tally_result(mdev, ret);
 }
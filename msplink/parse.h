@@ -42,6 +42,25 @@ typedef struct {
     uint8_t checksum;
 } mspPacket_t;
 
+enum MSP_PARSER_STATES {
+    MSP_PARSE_SYNC,             // looking for '$'
+    MSP_PARSE_VERSION,
+    MSP_PARSE_DIRECTION,
+    MSP_PARSE_V1_HEADER,
+    MSP_PARSE_V1_JUMBO,
+    MSP_PARSE_V2_HEADER,
+    MSP_PARSE_PAYLOAD,
+    MSP_PARSE_CHECKSUM,
+    MSP_PARSE_V1_TRAILER        // V1 checksum behind a tunneled V2 frame
+};
 
+void mspparser_init(mspparser_t* p, uint8_t* buf, size_t bufsize, mspbufpool_t* pool);
+void mspparser_reset(mspparser_t* p);
+int mspparser_feed(mspparser_t* p, const uint8_t* data, size_t len, size_t* used, mspPacket_t* pkt);
+int mspparser_pending(const mspparser_t* p);
+void mspparser_resync(mspparser_t* p);
 
-int parse_packet(mspdev_t* mdev, mspPacket_t* response);
+
+void parse_expect(mspdev_t* mdev, uint16_t command);
+int parse_packet(mspdev_t* mdev, mspPacket_t* response, int64_t deadline, uint16_t command);
+int parse_poll(mspdev_t* mdev, mspPacket_t* response);
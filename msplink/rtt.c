@@ -0,0 +1,136 @@
+/*
+This file is part of python-msptools.
+
+Python-msptools is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Python-msptools is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Round-trip time estimation, after TCP's retransmission timer (RFC 6298).
+
+Each command gets its own smoothed RTT and variance, since an attitude poll
+and an EEPROM write take very different times to answer. The RTT runs from
+the moment the request has been written until its response has been parsed.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "rtt.h"
+#include "msplink.h"
+#include "parse.h"
+#include "serial.h"
+
+// Private functions
+
+msprtt_t* rtt_slot(mspdev_t* mdev, uint16_t command) {
+    return &mdev->rtt[command & (MSP_RTT_SLOTS-1)];
+}
+
+// Keep the RTO between the clock granularity and the link timeout set by open()
+void rtt_set_rto(mspdev_t* mdev, msprtt_t* slot, int64_t rto) {
+    if (rto < MSP_RTT_GRANULARITY_US)   {rto = MSP_RTT_GRANULARITY_US;}
+    if (rto > mdev->timeout_us)         {rto = mdev->timeout_us;}
+
+    slot->rto_us = (int32_t)rto;
+}
+
+void rtt_sample(mspdev_t* mdev, uint16_t command, int64_t rtt) {
+
+    msprtt_t* slot = rtt_slot(mdev, command);
+    int64_t err;
+
+    if (!slot->valid || slot->command != command) {
+        // First measurement, or the slot belonged to another command
+        slot->command = command;
+        slot->valid = 1;
+        slot->srtt_us = (int32_t)rtt;
+        slot->rttvar_us = (int32_t)(rtt / 2);
+    }
+    else {
+        err = rtt - slot->srtt_us;
+        if (err < 0) {err = -err;}
+
+        slot->rttvar_us = (int32_t)((3 * (int64_t)slot->rttvar_us + err) / 4);
+        slot->srtt_us = (int32_t)((7 * (int64_t)slot->srtt_us + rtt) / 8);
+    }
+
+    rtt_set_rto(mdev, slot, slot->srtt_us +
+                (4 * (int64_t)slot->rttvar_us > MSP_RTT_GRANULARITY_US ? 4 * (int64_t)slot->rttvar_us : MSP_RTT_GRANULARITY_US));
+}
+
+// Public interface
+
+void rtt_reset(mspdev_t* mdev) {
+    memset(mdev->rtt, 0, sizeof(mdev->rtt));
+}
+
+// The estimate for command, or NULL if there isn't one yet
+const msprtt_t* rtt_lookup(mspdev_t* mdev, uint16_t command) {
+
+    msprtt_t* slot = rtt_slot(mdev, command);
+
+    if (!slot->valid || slot->command != command) {return NULL;}
+
+    return slot;
+}
+
+// How long to give a response to command, in microseconds. Commands without an estimate get the link timeout.
+int rtt_timeout(mspdev_t* mdev, uint16_t command) {
+
+    const msprtt_t* slot = rtt_lookup(mdev, command);
+
+    if (slot == NULL) {return mdev->timeout_us;}
+
+    return slot->rto_us;
+}
+
+/**
+ *  Account for the outcome of one transaction
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param command  [in]    the command that was sent
+ *  @param ret      [in]    what parse_packet() returned
+ *  @param response [in]    the packet parse_packet() filled in
+ *  @param sent     [in]    CLOCK_MONOTONIC time in microseconds when the request had been written
+ *  @param adaptive [in]    whether the response deadline came from rtt_timeout()
+ *  @param retransmit [in]  whether the request was a retry
+ *
+ *  -A response to the command that was sent (ACK or NACK) is an RTT sample, unless the request was
+ *   a retry: the response might belong to the earlier attempt (Karn's rule)
+ *  -A timeout on an adaptive deadline doubles that command's RTO, up to the link timeout, until the next sample
+ *
+ */
+void rtt_update(mspdev_t* mdev, uint16_t command, int ret, mspPacket_t* response, int64_t sent, int adaptive, int retransmit) {
+
+    msprtt_t* slot;
+
+    switch (ret) {
+        case MSP_OK:
+        case MSP_RX_CLIENT_NACK:
+            // A stale response to some earlier request says nothing about this one
+            if (response->function == command && !retransmit) {
+                rtt_sample(mdev, command, monotonic_us() - sent);
+            }
+            break;
+        case MSP_RX_FAIL:
+        case MSP_RX_SYNC_NOT_FOUND:
+            slot = rtt_slot(mdev, command);
+            if (adaptive && slot->valid && slot->command == command) {
+                rtt_set_rto(mdev, slot, 2 * (int64_t)slot->rto_us);
+            }
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,29 @@
+/*
+This file is part of python-msptools.
+
+Python-msptools is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Python-msptools is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "msplink.h"
+#include "parse.h"
+
+#define MSP_RTT_GRANULARITY_US 1000             // least slack an RTO gets over the smoothed RTT
+
+void rtt_reset(mspdev_t* mdev);
+int rtt_timeout(mspdev_t* mdev, uint16_t command);
+void rtt_update(mspdev_t* mdev, uint16_t command, int ret, mspPacket_t* response, int64_t sent, int adaptive, int retransmit);
+const msprtt_t* rtt_lookup(mspdev_t* mdev, uint16_t command);
@@ -18,6 +18,7 @@ along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
 #include <endian.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/uio.h>
 
 #include "send.h"
 #include "msplink.h"
@@ -33,15 +34,21 @@ along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
  *  @param payload_len [in] lenght of the command payload data
  *
  *  Generates an MSP V1 packet with the given parameter data. If the given
- *  payload_len is greater than 255, a JUMBO packet will be generated.
+ *  payload_len is 255 or more, a JUMBO packet will be generated (a size byte
+ *  of 255 is the JUMBO marker, so 255 itself can only be sent this way).
+ *
+ *  The header, payload and checksum go out in a single writev() so the
+ *  driver sees one contiguous transfer.
  *
  */
 int send_V1(mspdev_t* mdev, uint8_t cmd, uint8_t* payload, uint16_t payload_len) {
 
     uint8_t checksum = 0;
     int ret;
-    uint8_t buf[5];
+    uint8_t buf[7];
     uint8_t* pBuf = buf;
+    struct iovec iov[3];
+    int iovcnt = 0;
 
     union {
         uint8_t bytes[2];
@@ -52,47 +59,46 @@ int send_V1(mspdev_t* mdev, uint8_t cmd, uint8_t* payload, uint16_t payload_len)
     *(pBuf++) = 'M';
     *(pBuf++) = '<';
 
-    if (payload_len > 255)      {*(pBuf++) = 255;}
+    if (payload_len >= 255)     {*(pBuf++) = 255;}
     else                        {*(pBuf++) = payload_len;}
 
-    *pBuf = cmd;
-
-    checksum = payload_len ^ cmd;
-
-    ret = msplink_write(mdev, buf, 5);
-    if (ret<0) {return ret;}
+    *(pBuf++) = cmd;
 
     // Generate a JUMBO packet by putting the real payload size
     // in the first two bytes after the Command byte.
     // There is ambiguity in whether the length should include the two length bytes or not,
     // but based on the way the protocol description is written, I'll assume not.
-    if (payload_len > 255) {
+    if (payload_len >= 255) {
         payload_len_le.value = htole16(payload_len);
-        ret = msplink_write(mdev, payload_len_le.bytes, 2);
-        if (ret<0) {return ret;}
-
-        checksum ^= payload_len_le.bytes[0];
-        checksum ^= payload_len_le.bytes[1];
+        *(pBuf++) = payload_len_le.bytes[0];
+        *(pBuf++) = payload_len_le.bytes[1];
     }
 
-    ret = msplink_write(mdev, payload, payload_len);
-    if (ret<0) {return ret;}
-
+    // Size, command and JUMBO size are all covered by the checksum
+    checksum = checksum_xor(&buf[3], pBuf - &buf[3], 0);
     checksum = checksum_xor(payload, payload_len, checksum);
 
-    ret = msplink_write(mdev, &checksum, 1);
+    iov[iovcnt].iov_base = buf;
+    iov[iovcnt++].iov_len = pBuf - buf;
+
+    if (payload_len > 0) {
+        iov[iovcnt].iov_base = payload;
+        iov[iovcnt++].iov_len = payload_len;
+    }
+
+    iov[iovcnt].iov_base = &checksum;
+    iov[iovcnt++].iov_len = 1;
+
+    ret = msplink_writev(mdev, iov, iovcnt);
     if (ret<0) {return ret;}
 
+    mdev->stats.tx_frames++;
     return MSP_OK;
 }
 
 
-
-// Send the given msp V2 packet with given flag, command, and payload
-// if 0 is returned, response contains the validated returned packet data
-
 /**
- *  MSP V1 packet sender
+ *  MSP V2 packet sender
  *
  *  @param mdev     [in]    an MSP device pointer
  *  @param flag     [in]    packet flag value
@@ -100,15 +106,18 @@ int send_V1(mspdev_t* mdev, uint8_t cmd, uint8_t* payload, uint16_t payload_len)
  *  @param payload  [in]    the command payload data
  *  @param payload_len [in] lenght of the command payload data
  *
- *  Generates an MSP V2 packet with the given parameter data.
+ *  Generates an MSP V2 packet with the given parameter data. As with
+ *  send_V1(), the whole frame is handed to the kernel in one writev().
  *
  */
 int send_V2(mspdev_t* mdev, uint8_t flag, uint16_t cmd, uint8_t* payload, uint16_t payload_len) {
 
     uint8_t checksum = 0;
     int ret;
-    uint8_t buf[7];
+    uint8_t buf[8];
     uint8_t* pBuf = buf;
+    struct iovec iov[3];
+    int iovcnt = 0;
 
     union byteswaps {
         uint8_t bytes[2];
@@ -127,17 +136,23 @@ int send_V2(mspdev_t* mdev, uint8_t flag, uint16_t cmd, uint8_t* payload, uint16
     *(pBuf++) = payload_len_le.bytes[0];
     *pBuf = payload_len_le.bytes[1];
 
-    ret = msplink_write(mdev, buf, 8);
-    if (ret<0) {return ret;}
-
-    ret = msplink_write(mdev, payload, payload_len);
-    if (ret<0) {return ret;}
-
     checksum = checksum_crc8_dvb_s2(&buf[3], 5, 0);
     checksum = checksum_crc8_dvb_s2(payload, payload_len, checksum);
 
-    ret = msplink_write(mdev, &checksum, 1);
+    iov[iovcnt].iov_base = buf;
+    iov[iovcnt++].iov_len = 8;
+
+    if (payload_len > 0) {
+        iov[iovcnt].iov_base = payload;
+        iov[iovcnt++].iov_len = payload_len;
+    }
+
+    iov[iovcnt].iov_base = &checksum;
+    iov[iovcnt++].iov_len = 1;
+
+    ret = msplink_writev(mdev, iov, iovcnt);
     if (ret<0) {return ret;}
 
+    mdev->stats.tx_frames++;
     return MSP_OK;
 }
@@ -23,34 +23,105 @@ Portions from Stack Overflow are licensed Creative Commons Attribution-Share Ali
 https://creativecommons.org/licenses/by-sa/3.0/
 */
 
+#define _GNU_SOURCE             // ppoll()
+
 #include <errno.h>
 #include <fcntl.h> 
+#include <poll.h>
 #include <stdlib.h>
 #include <termios.h>
+#include <time.h>
+#include <string.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
 #include <stdint.h>
 #include <stddef.h>
+#include <limits.h>
+#include <stdio.h>
 
 #include "serial.h"
 #include "msplink.h"
+#include "termios2.h"
+#include "uring.h"
+#include "parse.h"
+#include "bufpool.h"
 
 // Private functions
 
-int set_interface_attribs(mspdev_t* mdev, int speed) {
+// Map a baud rate in bits/s to its Bxxxx constant, or B0 if there isn't one
+speed_t baudrate_to_speed(int baudrate) {
+
+    switch (baudrate) {
+        case 9600:      return B9600;
+        case 19200:     return B19200;
+        case 38400:     return B38400;
+        case 57600:     return B57600;
+        case 115200:    return B115200;
+        case 230400:    return B230400;
+#ifdef B460800
+        case 460800:    return B460800;
+#endif
+#ifdef B500000
+        case 500000:    return B500000;
+#endif
+#ifdef B576000
+        case 576000:    return B576000;
+#endif
+#ifdef B921600
+        case 921600:    return B921600;
+#endif
+#ifdef B1000000
+        case 1000000:   return B1000000;
+#endif
+#ifdef B1152000
+        case 1152000:   return B1152000;
+#endif
+#ifdef B1500000
+        case 1500000:   return B1500000;
+#endif
+#ifdef B2000000
+        case 2000000:   return B2000000;
+#endif
+#ifdef B2500000
+        case 2500000:   return B2500000;
+#endif
+#ifdef B3000000
+        case 3000000:   return B3000000;
+#endif
+#ifdef B3500000
+        case 3500000:   return B3500000;
+#endif
+#ifdef B4000000
+        case 4000000:   return B4000000;
+#endif
+        default:        return B0;
+    }
+}
+
+int set_interface_attribs(mspdev_t* mdev, int baudrate) {
 
     struct termios tty;
 
+    // Non-standard rates are programmed through termios2 after the rest of the
+    // attributes are set, so park the speed at something valid until then.
+    speed_t speed = baudrate_to_speed(baudrate);
+    int custom_rate = (speed == B0);
+    if (custom_rate) {speed = B38400;}
+
     if (tcgetattr(mdev->fd, &tty) != 0) {
         mdev->errornum = errno;
         return MSP_SYSCALL_FAIL;
     }
 
-    if (cfsetospeed(&tty, (speed_t)speed) != 0) {
+    if (cfsetospeed(&tty, speed) != 0) {
         mdev->errornum = errno;
         return MSP_SYSCALL_FAIL;
     }
-    if (cfsetispeed(&tty, (speed_t)speed) != 0) {
+    if (cfsetispeed(&tty, speed) != 0) {
         mdev->errornum = errno;
         return MSP_SYSCALL_FAIL;
     }
@@ -60,97 +131,322 @@ int set_interface_attribs(mspdev_t* mdev, int speed) {
     tty.c_cflag |= CS8;         /* 8-bit characters */
     tty.c_cflag &= ~PARENB;     /* no parity bit */
     tty.c_cflag &= ~CSTOPB;     /* only need 1 stop bit */
-    tty.c_cflag &= ~CRTSCTS;    /* no hardware flowcontrol */
+    if (mdev->flow_control) {
+        tty.c_cflag |= CRTSCTS;     /* RTS/CTS hardware flowcontrol */
+    }
+    else {
+        tty.c_cflag &= ~CRTSCTS;    /* no hardware flowcontrol */
+    }
 
     /* setup for non-canonical mode */
     tty.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
     tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
     tty.c_oflag &= ~OPOST;
 
-    /* fetch bytes as they become available */
-    tty.c_cc[VMIN] = 0;             // allow the read to timeout after as few as 0 bytes
-    tty.c_cc[VTIME] = 1;            // timeout after 0.1s
+    /* never block in read(), waiting is done with ppoll() in fd_wait() before rxring_fill() reads */
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
 
     if (tcsetattr(mdev->fd, TCSANOW, &tty) != 0) {
         mdev->errornum = errno;
         return MSP_SYSCALL_FAIL;
     }
 
+    if (custom_rate && termios2_set_baudrate(mdev->fd, baudrate) != 0) {
+        mdev->errornum = errno;
+        return MSP_SYSCALL_FAIL;
+    }
+
     return MSP_OK;
 }
 
-// Public interface
-
-int msplink_open(mspdev_t* mdev) {
+/**
+ *  Read the UART error counters
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param count    [out]   the driver's counters
+ *
+ *  Only real UART drivers keep these; ptys and most USB CDC-ACM adapters
+ *  fail with ENOTTY or EINVAL, which leaves the line statistics unavailable.
+ *
+ */
+int read_linecount(mspdev_t* mdev, msplinecount_t* count) {
 
-    mdev->fd = open(mdev->devname, O_RDWR | O_NOCTTY | O_SYNC);
+#if defined(TIOCGICOUNT)
+    struct serial_icounter_struct icount;
 
-    if (mdev->fd < 0) {
+    if (ioctl(mdev->fd, TIOCGICOUNT, &icount) != 0) {
         mdev->errornum = errno;
         return MSP_SYSCALL_FAIL;
     }
 
-    if (set_interface_attribs(mdev, B115200) != 0) {
-        mdev->errornum = errno;
-        return MSP_SYSCALL_FAIL;
-    }
+    count->overrun = icount.overrun;
+    count->frame = icount.frame;
+    count->parity = icount.parity;
+    count->brk = icount.brk;
+    count->buf_overrun = icount.buf_overrun;
 
     return MSP_OK;
+#else
+    mdev->errornum = ENOTTY;
+    return MSP_SYSCALL_FAIL;
+#endif
 }
 
-int msplink_close(mspdev_t* mdev) {
+/**
+ *  Ask the tty driver to push received bytes up immediately
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *
+ *  Sets ASYNC_LOW_LATENCY through TIOCSSERIAL. Plenty of drivers (and every
+ *  pty) don't implement the serial_struct ioctls, so failure just leaves the
+ *  tuning unapplied rather than failing the open.
+ *
+ */
+void set_low_latency(mspdev_t* mdev) {
 
-    mdev->fd = close(mdev->fd);
+#if defined(TIOCGSERIAL) && defined(ASYNC_LOW_LATENCY)
+    struct serial_struct serial;
 
-    if (mdev->fd < 0) {
-        mdev->errornum = errno;
-        return MSP_SYSCALL_FAIL;
+    if (ioctl(mdev->fd, TIOCGSERIAL, &serial) != 0) {return;}
+
+    mdev->saved_serial_flags = serial.flags;
+
+    if (serial.flags & ASYNC_LOW_LATENCY) {
+        mdev->tunings |= MSP_TUNE_ASYNC_LOW_LATENCY;
+        return;
     }
 
-    return MSP_OK;
+    serial.flags |= ASYNC_LOW_LATENCY;
+
+    if (ioctl(mdev->fd, TIOCSSERIAL, &serial) == 0) {
+        mdev->tunings |= MSP_TUNE_ASYNC_LOW_LATENCY;
+    }
+#endif
 }
 
-int msplink_write(mspdev_t* mdev, uint8_t* data, size_t len) {
+// Put back the driver flags set_low_latency() changed
+void restore_low_latency(mspdev_t* mdev) {
 
-    int ret = write(mdev->fd, data, len);
-    if ( ret < 0) {
-        mdev->errornum = errno;
-        return MSP_SYSCALL_FAIL;  
-    }
+#if defined(TIOCGSERIAL) && defined(ASYNC_LOW_LATENCY)
+    struct serial_struct serial;
+
+    if (!(mdev->tunings & MSP_TUNE_ASYNC_LOW_LATENCY)) {return;}
+    if (mdev->saved_serial_flags & ASYNC_LOW_LATENCY) {return;}
+
+    if (ioctl(mdev->fd, TIOCGSERIAL, &serial) != 0) {return;}
+
+    serial.flags &= ~ASYNC_LOW_LATENCY;
+    ioctl(mdev->fd, TIOCSSERIAL, &serial);
+#endif
+}
+
+// Read a small decimal sysfs attribute. Returns the value, or -1 if it can't be read.
+int read_sysfs_int(const char* path) {
+
+    char buf[32];
+    ssize_t len;
+    int fd = open(path, O_RDONLY);
 
-    if (ret != len) {
-        return MSP_TX_FAIL;
+    if (fd < 0) {return -1;}
+
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {return -1;}
+
+    buf[len] = 0;
+    return atoi(buf);
+}
+
+// Write a decimal sysfs attribute. sysfs takes the value in a single write() or rejects it.
+int write_sysfs_int(const char* path, int value) {
+
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%d\n", value);
+    int fd = open(path, O_WRONLY);
+    ssize_t ret;
+
+    if (fd < 0) {return -1;}
+
+    ret = write(fd, buf, len);
+    close(fd);
+
+    return (ret == len) ? 0 : -1;
+}
+
+/**
+ *  Set the latency timer of the USB-serial adapter behind the tty
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *
+ *  FTDI adapters (ftdi_sio) hold received bytes for up to latency_timer ms,
+ *  16 by default, before sending them to the host. Drivers that implement it
+ *  export the timer as <sysfs>/class/tty/<tty>/device/latency_timer, so the
+ *  attribute being there is the detection. The old value is saved for
+ *  restore_latency_timer(). A missing attribute or a refused write (writing
+ *  it usually takes root or a udev rule) just leaves the tuning unapplied.
+ *
+ */
+void set_latency_timer(mspdev_t* mdev) {
+
+    char resolved[PATH_MAX];
+    char path[PATH_MAX];
+    const char* name;
+    int previous;
+    int len;
+
+    // /dev/serial/by-id/... and friends are symlinks to the real node
+    if (realpath(mdev->devname, resolved) == NULL) {return;}
+
+    name = strrchr(resolved, '/');
+    name = (name == NULL) ? resolved : name + 1;
+
+    len = snprintf(path, sizeof(path), "%s/class/tty/%s/device/latency_timer",
+                   mdev->sysfs_root ? mdev->sysfs_root : MSP_SYSFS_ROOT_DEFAULT, name);
+    if (len < 0 || (size_t)len >= sizeof(path)) {return;}
+
+    previous = read_sysfs_int(path);
+    if (previous < 0) {return;}
+
+    if (previous != mdev->latency_timer && write_sysfs_int(path, mdev->latency_timer) != 0) {return;}
+
+    mdev->latency_timer_path = strdup(path);
+    if (mdev->latency_timer_path == NULL) {
+        write_sysfs_int(path, previous);
+        return;
     }
 
-    return MSP_OK;
+    mdev->saved_latency_timer = previous;
+    mdev->tunings |= MSP_TUNE_LATENCY_TIMER;
 }
 
-// either succeeds with full read count or fails with MSP_SYSCALL_FAIL or MSP_RX_FAIL
-int msplink_read(mspdev_t* mdev, uint8_t* buf, size_t len) {
+void restore_latency_timer(mspdev_t* mdev) {
+
+    if (mdev->latency_timer_path == NULL) {return;}
 
+    write_sysfs_int(mdev->latency_timer_path, mdev->saved_latency_timer);
+
+    free(mdev->latency_timer_path);
+    mdev->latency_timer_path = NULL;
+}
+
+int64_t monotonic_us(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Sleep until an absolute CLOCK_MONOTONIC time in microseconds
+void sleep_until(int64_t deadline) {
+    struct timespec ts = {.tv_sec = deadline / 1000000, .tv_nsec = (deadline % 1000000) * 1000};
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+// Shared transport operations for anything that is a plain file descriptor.
+// With io_uring enabled they hand off to uring.c instead of making the syscalls themselves.
+
+/**
+ *  Wait until the descriptor is ready for events or the deadline passes
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param events   [in]    poll() events to wait for, POLLIN or POLLOUT
+ *  @param deadline [in]    absolute CLOCK_MONOTONIC time in microseconds
+ *
+ *  Returns 1 when one of the events is ready, 0 on timeout, or MSP_SYSCALL_FAIL.
+ *  A hangup or error condition without the event is reported as EIO so the caller
+ *  doesn't spin on a dead descriptor until the deadline.
+ *
+ */
+int fd_poll(mspdev_t* mdev, short events, int64_t deadline) {
+
+    struct pollfd pfd = {.fd = mdev->fd, .events = events};
+    struct timespec ts;
+    int64_t remaining;
     int ret;
-    int remaining_cnt = len;
 
-    for (int i=0; i < mdev->read_retries; i++) {
-        ret = read(mdev->fd, buf, remaining_cnt);
+    for (;;) {
+        remaining = deadline - monotonic_us();
+        if (remaining < 0) {remaining = 0;}
 
-        if (ret<0) {
+        ts.tv_sec = remaining / 1000000;
+        ts.tv_nsec = (remaining % 1000000) * 1000;
+
+        ret = ppoll(&pfd, 1, &ts, NULL);
+
+        if (ret < 0) {
+            if (errno == EINTR) {continue;}     // recompute the remaining time and go again
             mdev->errornum = errno;
             return MSP_SYSCALL_FAIL;
         }
 
-        if (remaining_cnt == 0) {
-            return len;
-        }
+        if (ret == 0) {return 0;}
+
+        if (pfd.revents & events) {return 1;}
+
+        mdev->errornum = (pfd.revents & POLLNVAL) ? EBADF : EIO;
+        return MSP_SYSCALL_FAIL;
+    }
+}
+
+// Wait until the device has input or the deadline passes, see fd_poll()
+int fd_wait(mspdev_t* mdev, int64_t deadline) {
+
+    if (mdev->uring) {return uring_wait(mdev, deadline);}
+
+    return fd_poll(mdev, POLLIN, deadline);
+}
+
+// Non-blocking read into iov. Returns the byte count, 0 if nothing was ready, or MSP_SYSCALL_FAIL.
+ssize_t fd_read(mspdev_t* mdev, struct iovec* iov, int iovcnt) {
+
+    ssize_t ret;
+
+    if (mdev->uring) {return uring_read(mdev, iov, iovcnt);}
+
+    ret = readv(mdev->fd, iov, iovcnt);
 
-        remaining_cnt -= ret;
-        buf += ret;
+    if (ret<0) {
+        if (errno == EINTR || errno == EAGAIN) {return 0;}
+        mdev->errornum = errno;
+        return MSP_SYSCALL_FAIL;
     }
 
-    return MSP_RX_FAIL;
+    return ret;
 }
 
-int msplink_bytesavailable(mspdev_t* mdev) {
+ssize_t fd_writev(mspdev_t* mdev, struct iovec* iov, int iovcnt) {
+
+    ssize_t ret;
+
+    if (mdev->uring) {return uring_writev(mdev, iov, iovcnt);}
+
+    ret = writev(mdev->fd, iov, iovcnt);
+
+    if (ret<0) {
+        mdev->errornum = errno;
+        return MSP_SYSCALL_FAIL;
+    }
+
+    return ret;
+}
+
+int fd_close(mspdev_t* mdev) {
+
+    uring_teardown(mdev);
+
+    mdev->fd = close(mdev->fd);
+
+    if (mdev->fd < 0) {
+        mdev->errornum = errno;
+        return MSP_SYSCALL_FAIL;
+    }
+
+    return MSP_OK;
+}
+
+int fd_bytesavailable(mspdev_t* mdev) {
     int bytes_available;
 
     if (ioctl(mdev->fd, FIONREAD, &bytes_available) != 0) {
@@ -158,11 +454,55 @@ int msplink_bytesavailable(mspdev_t* mdev) {
         return MSP_SYSCALL_FAIL;
     }
 
+    if (mdev->uring) {bytes_available += uring_buffered(mdev);}
+
     return bytes_available;
 }
 
-// This can be used to ensure the entire packet was sent before proceeding
-int msplink_waituntilsent(mspdev_t* mdev) {
+// Serial (tty) transport
+
+int serial_open(mspdev_t* mdev, int64_t __attribute__((__unused__)) deadline) {
+
+    int flags = O_RDWR | O_NOCTTY;
+
+    // Frames are always written whole with writev(), so O_SYNC only adds a wait per write
+    if (mdev->low_latency)  {mdev->tunings |= MSP_TUNE_NO_OSYNC;}
+    else                    {flags |= O_SYNC;}
+
+    mdev->fd = open(mdev->devname, flags);
+
+    if (mdev->fd < 0) {
+        mdev->errornum = errno;
+        return MSP_SYSCALL_FAIL;
+    }
+
+    if (set_interface_attribs(mdev, mdev->baudrate) != 0) {
+        close(mdev->fd);
+        return MSP_SYSCALL_FAIL;
+    }
+
+    if (mdev->low_latency) {
+        set_low_latency(mdev);
+    }
+
+    if (mdev->latency_timer > 0) {
+        set_latency_timer(mdev);
+    }
+
+    mdev->has_linecount = (read_linecount(mdev, &mdev->linecount_base) == MSP_OK);
+
+    return MSP_OK;
+}
+
+int serial_close(mspdev_t* mdev) {
+
+    restore_low_latency(mdev);
+    restore_latency_timer(mdev);
+
+    return fd_close(mdev);
+}
+
+int serial_drain(mspdev_t* mdev) {
     if (tcdrain(mdev->fd) != 0) {
         mdev->errornum = errno;
         return MSP_SYSCALL_FAIL;
@@ -172,10 +512,23 @@ int msplink_waituntilsent(mspdev_t* mdev) {
     }
 }
 
+// Bytes still in the driver's output queue, not yet shifted out of the UART
+int serial_outq(mspdev_t* mdev) {
+
+    int count = 0;
+
+    if (ioctl(mdev->fd, TIOCOUTQ, &count) != 0) {
+        mdev->errornum = errno;
+        return MSP_SYSCALL_FAIL;
+    }
+
+    return count;
+}
+
 // There can be problems with using this immediately after an open, so just use it
 // before you send a request for data
 // See https://stackoverflow.com/questions/13013387/clearing-the-serial-ports-buffer
-int msplink_clearRxBuffer(mspdev_t* mdev) {
+int serial_flush(mspdev_t* mdev) {
     if (tcflush(mdev->fd,TCIOFLUSH) != 0) {
         mdev->errornum = errno;
         return MSP_SYSCALL_FAIL;
@@ -185,5 +538,493 @@ int msplink_clearRxBuffer(mspdev_t* mdev) {
     }
 }
 
+const msptransport_t msptransport_serial = {
+    .name = "serial",
+    .prefix = NULL,
+    .datagram = 0,
+    .open = serial_open,
+    .close = serial_close,
+    .read = fd_read,
+    .writev = fd_writev,
+    .wait = fd_wait,
+    .drain = serial_drain,
+    .outq = serial_outq,
+    .flush = serial_flush,
+    .bytesavailable = fd_bytesavailable
+};
+
+// Transports picked by devname prefix. Anything that matches none of them is a tty path.
+const msptransport_t* const prefixed_transports[] = {
+    &msptransport_tcp,
+    &msptransport_udp,
+    NULL
+};
+
+// Receive ring
+
+size_t rxring_count(rxring_t* ring) {
+    return ring->head - ring->tail;
+}
+
+/**
+ *  Read as much as the kernel has into the free space of the ring
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *
+ *  The free space may wrap around the end of the ring, so both pieces are
+ *  handed to a single transport read. Returns the number of bytes added, 0 if
+ *  nothing was ready, or MSP_SYSCALL_FAIL.
+ *
+ */
+int rxring_fill(mspdev_t* mdev) {
+
+    rxring_t* ring = &mdev->rx;
+    size_t offset = ring->head & (RX_RING_SIZE-1);
+    size_t space = RX_RING_SIZE - rxring_count(ring);
+    struct iovec iov[2];
+    int iovcnt = 1;
+    ssize_t ret;
+
+    // An empty ring can start over at the beginning and skip the wrap
+    if (space == RX_RING_SIZE) {
+        ring->head = ring->tail = 0;
+        offset = 0;
+    }
+
+    iov[0].iov_base = &ring->data[offset];
+    iov[0].iov_len = RX_RING_SIZE - offset;
+
+    if (iov[0].iov_len >= space) {
+        iov[0].iov_len = space;
+    }
+    else {
+        iov[1].iov_base = ring->data;
+        iov[1].iov_len = space - iov[0].iov_len;
+        iovcnt = 2;
+    }
+
+    ret = mdev->transport->read(mdev, iov, iovcnt);
+    if (ret<0) {return ret;}
+
+    ring->head += ret;
+    return ret;
+}
+
+// Public interface
+
+int msplink_open(mspdev_t* mdev, int64_t deadline) {
+
+    const msptransport_t* const* candidate;
+    int ret;
+
+    mdev->tunings = 0;
+    mdev->uring = NULL;
+    mspparser_init(&mdev->parser, mdev->buf, READ_BUFFER_SIZE, &mdev->pool);
+    mdev->pending_count = 0;
+    mdev->rx_spill = NULL;
+    mdev->rx_spill_len = mdev->rx_spill_pos = 0;
+    mdev->has_linecount = 0;
+    mdev->latency_timer_path = NULL;
+    mdev->transport = &msptransport_serial;
+
+    for (candidate = prefixed_transports; *candidate != NULL; candidate++) {
+        if (strncmp(mdev->devname, (*candidate)->prefix, strlen((*candidate)->prefix)) == 0) {
+            mdev->transport = *candidate;
+            break;
+        }
+    }
+
+    ret = mdev->transport->open(mdev, deadline);
+    if (ret<0) {return ret;}
+
+    // io_uring only stands in for the stream fd operations; datagram reads need recvmsg()
+    // to spot truncation. If the kernel says no, the link just stays on plain syscalls.
+    if (mdev->io_uring && !mdev->transport->datagram && mdev->transport->read == fd_read) {
+        if (uring_setup(mdev) == MSP_OK) {
+            mdev->tunings |= MSP_TUNE_IO_URING;
+        }
+    }
+
+    return MSP_OK;
+}
+
+int msplink_close(mspdev_t* mdev) {
+    mspparser_reset(&mdev->parser);
+    bufpool_free(&mdev->pool);
+    msplink_dropspill(mdev);
+    bufpool_free(&mdev->rx_spill_pool);
+
+    if (mdev->link_down) {return MSP_OK;}      // already closed by msplink_reconnect()
+
+    msplink_updatelinestats(mdev);      // last look before the fd goes away
+
+    return mdev->transport->close(mdev);
+}
+
+// Write every byte described by iov, picking up after short writes. iov is modified.
+int msplink_writev(mspdev_t* mdev, struct iovec* iov, int iovcnt) {
+
+    ssize_t ret;
+
+    while (iovcnt > 0) {
+        ret = mdev->transport->writev(mdev, iov, iovcnt);
+
+        if (ret<0) {
+            if (mdev->errornum == EINTR) {continue;}
+            return ret;
+        }
+
+        if (ret == 0) {
+            return MSP_TX_FAIL;
+        }
+
+        // Skip past whatever made it out
+        while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return MSP_OK;
+}
+
+// Arm the response timeout for the next msplink_rxpeek(). Call this once before each response.
+// deadline is an absolute CLOCK_MONOTONIC time in microseconds that the whole response has to
+// arrive by, or MSP_NO_DEADLINE.
+void msplink_beginrx(mspdev_t* mdev, int64_t deadline) {
+    mdev->rx_started = 0;
+    mdev->rx_begin = monotonic_us();
+    mdev->rx_deadline = deadline;
+    mdev->rx_tx_us = 0;
+}
+
+// Look at how much of the request is still queued for the wire, so msplink_rxpeek() can start
+// listening right away and give the first byte of the response that much longer to arrive.
+// Call it after msplink_beginrx(). The time is estimated at 10 bits a byte (8N1).
+int msplink_txpending(mspdev_t* mdev) {
+
+    int ret;
+
+    if (mdev->transport->outq == NULL) {return MSP_OK;}
+
+    ret = mdev->transport->outq(mdev);
+    if (ret<0) {return ret;}
+
+    if ((uint64_t)ret > mdev->stats.tx_queue_peak) {mdev->stats.tx_queue_peak = ret;}
+
+    mdev->rx_tx_us = (int64_t)ret * 10 * 1000000 / mdev->baudrate;
+    return MSP_OK;
+}
+
+/**
+ *  Wait for response input as the timeouts allow, and show what is buffered
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param data     [out]   where the buffered bytes start
+ *
+ *  Returns how many bytes sit in one piece at *data (at least one), MSP_RX_FAIL at the
+ *  timeout, MSP_RX_WOULDBLOCK in non-blocking mode, or MSP_SYSCALL_FAIL. Nothing is taken
+ *  out of the ring until msplink_rxconsume(), so the parser can work on the bytes in place.
+ *
+ *  The ring is topped up with one large read whenever it runs dry, so a whole frame usually
+ *  costs one refill: the ppoll() in the transport's wait and the readv() in rxring_fill().
+ *
+ *  A response has timeout_us from msplink_beginrx() to get started, plus however long the
+ *  end of the request still needed to go out (see msplink_txpending()). Noise arriving in
+ *  the meantime doesn't move that deadline. Once the consumer marks the frame as started
+ *  (rx_started), each further wait is bounded by byte_timeout_us so a stalled frame is
+ *  detected after one inter-byte gap instead of a full response timeout.
+ *
+ *  A transaction deadline from msplink_beginrx() takes the place of timeout_us for the first
+ *  byte, and caps every wait after that.
+ *
+ *  In non-blocking mode a dry ring gets one poll of the transport that doesn't wait at all,
+ *  and MSP_RX_WOULDBLOCK if that brings nothing in.
+ */
+int msplink_rxpeek(mspdev_t* mdev, uint8_t** data) {
+
+    int ret;
+    size_t count;
+    size_t offset;
+    int64_t deadline;
+
+    while ((count = rxring_count(&mdev->rx)) == 0) {
+
+        // A frame never continues into the next datagram, but a big one may go on in the spill buffer
+        if (mdev->transport->datagram) {
+            if (mdev->rx_spill_pos == mdev->rx_spill_len) {return MSP_RX_FAIL;}
+
+            *data = mdev->rx_spill + mdev->rx_spill_pos;
+            return mdev->rx_spill_len - mdev->rx_spill_pos;
+        }
+
+        if (mdev->rx_nonblocking) {
+            deadline = 0;
+        }
+        else if (mdev->rx_started) {
+            deadline = monotonic_us() + mdev->byte_timeout_us;
+        }
+        else if (mdev->rx_deadline != MSP_NO_DEADLINE) {
+            deadline = mdev->rx_deadline;
+        }
+        else {
+            deadline = mdev->rx_begin + mdev->timeout_us + mdev->rx_tx_us;
+        }
+
+        if (mdev->rx_deadline != MSP_NO_DEADLINE && deadline > mdev->rx_deadline) {
+            deadline = mdev->rx_deadline;
+        }
+
+        ret = mdev->transport->wait(mdev, deadline);
+        if (ret<0)   {return ret;}
+        if (ret==0)  {return mdev->rx_nonblocking ? MSP_RX_WOULDBLOCK : MSP_RX_FAIL;}
+
+        ret = rxring_fill(mdev);
+        if (ret<0)   {return ret;}
+
+        // Readable but nothing to read means the other end went away
+        if (ret==0) {
+            mdev->errornum = EIO;
+            return MSP_SYSCALL_FAIL;
+        }
+    }
+
+    offset = mdev->rx.tail & (RX_RING_SIZE-1);
+    if (count > RX_RING_SIZE - offset) {count = RX_RING_SIZE - offset;}
+
+    *data = &mdev->rx.data[offset];
+    return count;
+}
+
+// Take len bytes shown by msplink_rxpeek() out of the ring
+void msplink_rxconsume(mspdev_t* mdev, size_t len) {
+    // msplink_rxpeek() only shows the spill buffer once the ring is empty
+    if (rxring_count(&mdev->rx) == 0) {
+        mdev->rx_spill_pos += len;
+        return;
+    }
+
+    mdev->rx.tail += len;
+}
+
+/**
+ *  Replace the ring contents with the next datagram
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param deadline [in]    absolute CLOCK_MONOTONIC time in microseconds
+ *
+ *  Whatever is left of the previous datagram is discarded, so the parser
+ *  always starts at a datagram boundary and msplink_rxpeek() stops at the end
+ *  of it. A datagram too big for the ring goes on in mdev->rx_spill, a buffer
+ *  from the spill pool that msplink_dropspill() hands back once the frame is
+ *  parsed, so frames up to MSP_FRAME_MAX arrive whole. If there is no memory for
+ *  it the datagram is dropped like any other that doesn't fit. Returns MSP_OK,
+ *  MSP_RX_FAIL at the deadline, or MSP_SYSCALL_FAIL.
+ *
+ */
+int msplink_nextdatagram(mspdev_t* mdev, int64_t deadline) {
+
+    struct iovec iov[2];
+    int iovcnt;
+    int size;
+    int ret;
+
+    mdev->stats.rx_discarded_bytes += rxring_count(&mdev->rx);
+    mdev->rx.head = mdev->rx.tail = 0;
+    msplink_dropspill(mdev);
+
+    iov[0].iov_base = mdev->rx.data;
+    iov[0].iov_len = RX_RING_SIZE;
+
+    for (;;) {
+        ret = mdev->transport->wait(mdev, deadline);
+        if (ret<0)   {return ret;}
+        if (ret==0)  {return MSP_RX_FAIL;}
+
+        // FIONREAD on a datagram socket is the size of the next datagram, so only the
+        // ones too big for the ring need a second buffer
+        size = mdev->transport->bytesavailable(mdev);
+        if (size<0)  {return size;}
+
+        iovcnt = 1;
+        if (size > RX_RING_SIZE) {
+            mdev->rx_spill = bufpool_get(&mdev->rx_spill_pool, size - RX_RING_SIZE);
+            if (mdev->rx_spill != NULL) {
+                iov[1].iov_base = mdev->rx_spill;
+                iov[1].iov_len = size - RX_RING_SIZE;
+                iovcnt = 2;
+            }
+        }
+
+        ret = mdev->transport->read(mdev, iov, iovcnt);
+        if (ret<0)   {return ret;}
+
+        if (ret > RX_RING_SIZE) {
+            mdev->rx.head = RX_RING_SIZE;
+            mdev->rx_spill_len = ret - RX_RING_SIZE;
+            return MSP_OK;
+        }
+
+        if (ret > 0) {
+            mdev->rx.head = ret;
+            return MSP_OK;
+        }
+
+        msplink_dropspill(mdev);
+    }
+}
+
+// Hand the spill buffer of a datagram too big for the ring back to its pool; whatever
+// the parser didn't take of it is discarded. The frame itself was copied out of it.
+void msplink_dropspill(mspdev_t* mdev) {
+    mdev->stats.rx_discarded_bytes += mdev->rx_spill_len - mdev->rx_spill_pos;
+    mdev->rx_spill = NULL;
+    mdev->rx_spill_len = mdev->rx_spill_pos = 0;
+    bufpool_trim(&mdev->rx_spill_pool);
+}
+
+// Bring the UART error counts in the link statistics up to date. They count from open(),
+// and are left alone where the driver doesn't keep them. Each look adds what the driver
+// counted since the last one, so errors seen on an fd that msplink_reconnect() replaced
+// stay in the totals.
+void msplink_updatelinestats(mspdev_t* mdev) {
+
+    msplinecount_t now;
+
+    if (!mdev->has_linecount) {return;}
+    if (read_linecount(mdev, &now) != MSP_OK) {return;}
+
+    // uint32_t differences stay right across a counter wrap
+    mdev->stats.rx_overruns += (uint32_t)(now.overrun - mdev->linecount_base.overrun);
+    mdev->stats.rx_framing_errors += (uint32_t)(now.frame - mdev->linecount_base.frame);
+    mdev->stats.rx_parity_errors += (uint32_t)(now.parity - mdev->linecount_base.parity);
+    mdev->stats.rx_breaks += (uint32_t)(now.brk - mdev->linecount_base.brk);
+    mdev->stats.rx_buffer_overruns += (uint32_t)(now.buf_overrun - mdev->linecount_base.buf_overrun);
+    mdev->linecount_base = now;
+}
+
+// Whether the last MSP_SYSCALL_FAIL means the device or peer is gone, rather than a one-off error
+int msplink_devicegone(mspdev_t* mdev) {
+    switch (mdev->errornum) {
+        case EIO:               // USB serial device unplugged or reset, or EOF on a socket
+        case ENXIO:
+        case ENODEV:
+        case EBADF:             // fd already closed, e.g. by a failed msplink_reconnect()
+        case ECONNRESET:
+        case EPIPE:
+        case ENOTCONN:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ *  Reopen a link whose device went away
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *  @param deadline [in]    absolute CLOCK_MONOTONIC time in microseconds to give up at
+ *
+ *  The dead fd is closed and devname is opened again the way msplink_open() did it the
+ *  first time (termios, tunings, io_uring), retrying with exponential backoff while the
+ *  device re-enumerates. Buffered input from before the drop is thrown away. If the
+ *  deadline passes first the link stays down, the fd stays closed, and the next call
+ *  picks up where this one left off.
+ *
+ *  Returns MSP_OK, or MSP_SYSCALL_FAIL with the errno of the last open attempt.
+ */
+int msplink_reconnect(mspdev_t* mdev, int64_t deadline) {
+
+    int64_t backoff = MSP_RECONNECT_BACKOFF_MIN_US;
+    int64_t now;
+    int ret;
+
+    if (!mdev->link_down) {
+        msplink_close(mdev);            // errors don't matter, the fd is going away regardless
+        mdev->fd = -1;
+        mdev->link_down = 1;
+        mdev->down_since = monotonic_us();
+        mdev->stats.link_drops++;
+    }
+
+    msplink_discardRxBuffer(mdev);
+
+    for (;;) {
+        ret = msplink_open(mdev, deadline);
+        now = monotonic_us();
 
+        if (ret == MSP_OK) {
+            mdev->link_down = 0;
+            mdev->stats.reconnects++;
+            mdev->stats.downtime_us += now - mdev->down_since;
+            return MSP_OK;
+        }
+
+        if (now + backoff >= deadline) {return ret;}
+
+        sleep_until(now + backoff);
+
+        backoff *= 2;
+        if (backoff > MSP_RECONNECT_BACKOFF_MAX_US) {backoff = MSP_RECONNECT_BACKOFF_MAX_US;}
+    }
+}
+
+// Change the rate of an open serial link in place, without closing the fd. Bytes still
+// buffered in either direction are left alone.
+int msplink_setbaudrate(mspdev_t* mdev, int baudrate) {
+
+    int ret;
 
+    if (mdev->transport != &msptransport_serial) {return MSP_LIB_INTERNAL_ERROR;}
+
+    ret = set_interface_attribs(mdev, baudrate);
+    if (ret<0) {return ret;}
+
+    mdev->baudrate = baudrate;
+    return MSP_OK;
+}
+
+// The descriptor an outside event loop should wait on for input
+int msplink_fileno(mspdev_t* mdev) {
+    if (mdev->link_down) {
+        mdev->errornum = ENODEV;
+        return MSP_SYSCALL_FAIL;
+    }
+
+    if (mdev->uring) {return uring_fileno(mdev);}
+
+    return mdev->fd;
+}
+
+int msplink_clearRxBuffer(mspdev_t* mdev) {
+    mdev->rx.head = mdev->rx.tail = 0;
+    mdev->rx_spill = NULL;
+    mdev->rx_spill_len = mdev->rx_spill_pos = 0;
+    bufpool_trim(&mdev->rx_spill_pool);
+    mspparser_reset(&mdev->parser);
+    mdev->pending_count = 0;            // their responses went with the input
+    mdev->stats.rx_flushes++;
+
+    if (mdev->uring) {uring_discard(mdev);}
+
+    return mdev->transport->flush(mdev);
+}
+
+// The no-syscall alternative to msplink_clearRxBuffer(): drop whatever the ring (and the parser) already holds
+// and leave the kernel queues alone. Anything stale still in flight is skipped by the parser's
+// sync search. Pending TX bytes are never touched.
+void msplink_discardRxBuffer(mspdev_t* mdev) {
+    if (mdev->uring) {mdev->stats.rx_discarded_bytes += uring_discard(mdev);}
+
+    mdev->stats.rx_discarded_bytes += rxring_count(&mdev->rx);
+    mdev->rx.head = mdev->rx.tail = 0;
+    msplink_dropspill(mdev);
+    mspparser_reset(&mdev->parser);
+    mdev->pending_count = 0;            // and whatever is still on its way gets skipped
+}
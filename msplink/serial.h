@@ -19,12 +19,73 @@ along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include "msplink.h"
 
-int msplink_open(mspdev_t* mdev);
+/**
+ *  Transport operations behind an MSP link
+ *
+ *  parse.c and send.c only ever go through the msplink_* functions below, which
+ *  handle buffering and timeouts and call into the transport selected at open().
+ *
+ *  -open/close     set up and tear down mdev->fd (or whatever the transport uses); open gives up at
+ *                  the CLOCK_MONOTONIC deadline (us) where it could block, or MSP_NO_DEADLINE
+ *  -read           non-blocking read into iov: byte count, 0 if nothing ready, or an MSP error
+ *  -writev         write from iov: byte count (short writes are fine) or an MSP error
+ *  -wait           block until readable or the CLOCK_MONOTONIC deadline (us): 1, 0 on timeout, or an MSP error
+ *  -drain          block until written data has left the host, NULL if writes complete in the kernel
+ *  -outq           bytes written but not yet sent, NULL if writes complete in the kernel
+ *  -flush          drop pending input (and output where that means something)
+ *  -bytesavailable input bytes waiting in the kernel
+ *
+ *  A datagram transport returns exactly one frame per read and frames never
+ *  span reads. Errors set mdev->errornum as usual.
+ */
+typedef struct msptransport {
+    const char* name;
+    const char* prefix;             // devname prefix that selects this transport
+    int datagram;
+    int (*open)(mspdev_t* mdev, int64_t deadline);
+    int (*close)(mspdev_t* mdev);
+    ssize_t (*read)(mspdev_t* mdev, struct iovec* iov, int iovcnt);
+    ssize_t (*writev)(mspdev_t* mdev, struct iovec* iov, int iovcnt);
+    int (*wait)(mspdev_t* mdev, int64_t deadline);
+    int (*drain)(mspdev_t* mdev);
+    int (*outq)(mspdev_t* mdev);
+    int (*flush)(mspdev_t* mdev);
+    int (*bytesavailable)(mspdev_t* mdev);
+} msptransport_t;
+
+extern const msptransport_t msptransport_serial;
+extern const msptransport_t msptransport_tcp;
+extern const msptransport_t msptransport_udp;
+
+// Operations shared by every transport that is a plain file descriptor
+int fd_poll(mspdev_t* mdev, short events, int64_t deadline);
+int fd_wait(mspdev_t* mdev, int64_t deadline);
+ssize_t fd_read(mspdev_t* mdev, struct iovec* iov, int iovcnt);
+ssize_t fd_writev(mspdev_t* mdev, struct iovec* iov, int iovcnt);
+int fd_close(mspdev_t* mdev);
+int fd_bytesavailable(mspdev_t* mdev);
+
+int64_t monotonic_us(void);
+void sleep_until(int64_t deadline);
+
+int msplink_open(mspdev_t* mdev, int64_t deadline);
 int msplink_close(mspdev_t* mdev);
-int msplink_write(mspdev_t* mdev, uint8_t* data, size_t len);
-int msplink_read(mspdev_t* mdev, uint8_t* buf, size_t len);
-int msplink_bytesavailable(mspdev_t* mdev);
-int msplink_waituntilsent(mspdev_t* mdev);
+int msplink_writev(mspdev_t* mdev, struct iovec* iov, int iovcnt);
+void msplink_beginrx(mspdev_t* mdev, int64_t deadline);
+int msplink_rxpeek(mspdev_t* mdev, uint8_t** data);
+void msplink_rxconsume(mspdev_t* mdev, size_t len);
+size_t rxring_count(rxring_t* ring);
+int msplink_nextdatagram(mspdev_t* mdev, int64_t deadline);
+void msplink_dropspill(mspdev_t* mdev);
+int msplink_txpending(mspdev_t* mdev);
+int msplink_fileno(mspdev_t* mdev);
+int msplink_setbaudrate(mspdev_t* mdev, int baudrate);
+void msplink_updatelinestats(mspdev_t* mdev);
+int msplink_devicegone(mspdev_t* mdev);
+int msplink_reconnect(mspdev_t* mdev, int64_t deadline);
 int msplink_clearRxBuffer(mspdev_t* mdev);
+void msplink_discardRxBuffer(mspdev_t* mdev);
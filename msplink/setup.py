@@ -8,6 +8,11 @@ msplink_module = Extension('msplink', sources =
      'parse.c',
      'send.c',
      'serial.c',
+     'termios2.c',
+     'network.c',
+     'uring.c',
+     'rtt.c',
+     'bufpool.c',
      'checksums.c'])
 
 setup(name='msplink',
@@ -0,0 +1,67 @@
+/*
+This file is part of python-msptools.
+
+Python-msptools is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Python-msptools is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
+
+---------
+
+<termios.h> and <asm/termbits.h> both define struct termios and can't be
+included in the same translation unit, so the termios2 (BOTHER) path for
+arbitrary baud rates lives here, away from the rest of the serial code.
+*/
+
+#include <errno.h>
+
+#ifdef __linux__
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "termios2.h"
+
+/**
+ *  Program an arbitrary baud rate on an already configured tty
+ *
+ *  @param fd       [in]    an open tty file descriptor
+ *  @param baudrate [in]    the requested baud rate in bits/s
+ *
+ *  Only the speed fields are touched; everything else set up by tcsetattr()
+ *  is left alone. Returns 0 on success or -1 with errno set. Non-Linux
+ *  systems fail with EINVAL since there is no portable way to do this.
+ *
+ */
+int termios2_set_baudrate(int fd, int baudrate) {
+
+#if defined(__linux__) && defined(BOTHER)
+    struct termios2 tty;
+
+    if (ioctl(fd, TCGETS2, &tty) != 0) {
+        return -1;
+    }
+
+    tty.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tty.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    tty.c_ispeed = baudrate;
+    tty.c_ospeed = baudrate;
+
+    if (ioctl(fd, TCSETS2, &tty) != 0) {
+        return -1;
+    }
+
+    return 0;
+#else
+    errno = EINVAL;
+    return -1;
+#endif
+}
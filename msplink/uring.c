@@ -0,0 +1,500 @@
+/*
+This file is part of python-msptools.
+
+Python-msptools is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Python-msptools is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+io_uring I/O backend for the file descriptor transports
+
+A poll->read chain is kept armed on the link at all times, reading into a
+staging buffer. Whatever the responder sends is usually sitting in the
+completion queue by the time the parser asks for it, so a response costs no
+syscall at all, and waiting for one is a single io_uring_enter() with a
+timeout instead of ppoll() followed by read(). Writes are submitted together
+with any queued read re-arm, so a request/response transaction needs at most
+two syscalls.
+
+The kernel interface is used directly rather than through liburing to avoid
+a build dependency.
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+#include "serial.h"
+#include "msplink.h"
+
+#ifdef MSPLINK_HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#if defined(MSPLINK_HAVE_IO_URING) && defined(IORING_ENTER_EXT_ARG)
+
+#define URING_ENTRIES 8
+#define URING_CANCEL_TIMEOUT_US 100000
+
+enum URING_TAGS {
+    URING_TAG_POLL = 1,
+    URING_TAG_READ = 2,
+    URING_TAG_WRITE = 3,
+    URING_TAG_CANCEL = 4
+};
+
+struct mspuring {
+    int ring_fd;
+    void* ring;
+    size_t ring_len;
+    struct io_uring_sqe* sqes;
+    size_t sqes_len;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    int read_pending;           // poll->read chain in flight
+    int read_error;             // errno from the last read completion, 0 if none
+    int write_pending;
+    ssize_t write_result;
+
+    size_t staged;              // completed bytes in staging not yet handed out
+    size_t staged_off;
+    uint8_t staging[RX_RING_SIZE];
+};
+
+// Private functions
+
+struct io_uring_sqe* uring_get_sqe(struct mspuring* u) {
+
+    unsigned tail = *u->sq_tail;
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe* sqe;
+
+    if (tail - head >= u->sq_entries) {return NULL;}
+
+    sqe = &u->sqes[tail & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+// Make the SQE returned by the last uring_get_sqe() visible to the kernel
+void uring_commit_sqe(struct mspuring* u) {
+
+    unsigned tail = *u->sq_tail;
+
+    u->sq_array[tail & u->sq_mask] = tail & u->sq_mask;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ *  Submit queued SQEs and optionally wait for a completion
+ *
+ *  @param mdev         [in]    an MSP device pointer
+ *  @param min_complete [in]    completions to wait for, 0 to only submit
+ *  @param deadline     [in]    absolute CLOCK_MONOTONIC time in microseconds, or -1 for no limit
+ *
+ *  Returns MSP_OK whether or not anything completed before the deadline (the
+ *  caller reaps and looks), or MSP_SYSCALL_FAIL.
+ *
+ */
+int uring_enter(mspdev_t* mdev, unsigned min_complete, int64_t deadline) {
+
+    struct mspuring* u = mdev->uring;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned to_submit = *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = 0;
+    void* argp = NULL;
+    size_t argsz = 0;
+    int64_t remaining;
+    int ret;
+
+    if (to_submit == 0 && min_complete == 0) {return MSP_OK;}
+
+    if (min_complete > 0) {flags |= IORING_ENTER_GETEVENTS;}
+
+    if (min_complete > 0 && deadline >= 0) {
+        remaining = deadline - monotonic_us();
+        if (remaining < 0) {remaining = 0;}
+
+        ts.tv_sec = remaining / 1000000;
+        ts.tv_nsec = (remaining % 1000000) * 1000;
+
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+
+    ret = syscall(__NR_io_uring_enter, u->ring_fd, to_submit, min_complete, flags, argp, argsz);
+
+    if (ret < 0 && errno != ETIME && errno != EINTR) {
+        mdev->errornum = errno;
+        return MSP_SYSCALL_FAIL;
+    }
+
+    return MSP_OK;
+}
+
+// Drain the completion queue into the link state. Never makes a syscall.
+void uring_reap(mspdev_t* mdev) {
+
+    struct mspuring* u = mdev->uring;
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    struct io_uring_cqe* cqe;
+
+    while (head != tail) {
+        cqe = &u->cqes[head & u->cq_mask];
+
+        switch (cqe->user_data) {
+            case URING_TAG_POLL:
+                // On success the linked read reports; a failed poll cancels it
+                if (cqe->res < 0 && cqe->res != -ECANCELED) {u->read_error = -cqe->res;}
+                break;
+            case URING_TAG_READ:
+                u->read_pending = 0;
+                if (cqe->res > 0) {
+                    u->staged = cqe->res;
+                    u->staged_off = 0;
+                }
+                else if (cqe->res == 0) {
+                    u->read_error = EIO;        // readable but empty, the other end went away
+                }
+                else if (cqe->res != -ECANCELED && cqe->res != -EAGAIN && cqe->res != -EINTR) {
+                    u->read_error = -cqe->res;
+                }
+                break;
+            case URING_TAG_WRITE:
+                u->write_pending = 0;
+                u->write_result = cqe->res;
+                break;
+            default:
+                break;
+        }
+
+        head++;
+    }
+
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Queue a poll->read chain into the staging buffer unless one is in flight or data is waiting
+void uring_arm_read(mspdev_t* mdev) {
+
+    struct mspuring* u = mdev->uring;
+    struct io_uring_sqe* sqe;
+
+    if (u->read_pending || u->staged > 0) {return;}
+
+    sqe = uring_get_sqe(u);
+    if (sqe == NULL) {return;}
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = mdev->fd;
+    sqe->poll32_events = POLLIN;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = URING_TAG_POLL;
+    uring_commit_sqe(u);
+
+    sqe = uring_get_sqe(u);
+    if (sqe == NULL) {return;}
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = mdev->fd;
+    sqe->addr = (uint64_t)(uintptr_t)u->staging;
+    sqe->len = sizeof(u->staging);
+    sqe->off = (uint64_t)-1;            // current position, as read() would
+    sqe->user_data = URING_TAG_READ;
+    uring_commit_sqe(u);
+
+    u->read_pending = 1;
+}
+
+// Public interface
+
+/**
+ *  Put an fd transport on io_uring
+ *
+ *  @param mdev     [in]    an MSP device pointer with an open fd
+ *
+ *  Returns MSP_OK, or MSP_SYSCALL_FAIL if the kernel lacks io_uring or the
+ *  features used here (single mmap, timeouts on enter). On failure the link
+ *  simply keeps using plain syscalls.
+ *
+ */
+int uring_setup(mspdev_t* mdev) {
+
+    struct io_uring_params params;
+    struct mspuring* u;
+    size_t sq_len, cq_len;
+
+    u = calloc(1, sizeof(*u));
+    if (u == NULL) {
+        mdev->errornum = ENOMEM;
+        return MSP_SYSCALL_FAIL;
+    }
+
+    memset(&params, 0, sizeof(params));
+    u->ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (u->ring_fd < 0) {
+        mdev->errornum = errno;
+        free(u);
+        return MSP_SYSCALL_FAIL;
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        mdev->errornum = ENOSYS;
+        goto setup_error;
+    }
+
+    sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    u->ring_len = (sq_len > cq_len) ? sq_len : cq_len;
+
+    u->ring = mmap(NULL, u->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->ring_fd, IORING_OFF_SQ_RING);
+    if (u->ring == MAP_FAILED) {
+        mdev->errornum = errno;
+        goto setup_error;
+    }
+
+    u->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->ring_fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        mdev->errornum = errno;
+        munmap(u->ring, u->ring_len);
+        goto setup_error;
+    }
+
+    u->sq_head = (unsigned*)((uint8_t*)u->ring + params.sq_off.head);
+    u->sq_tail = (unsigned*)((uint8_t*)u->ring + params.sq_off.tail);
+    u->sq_array = (unsigned*)((uint8_t*)u->ring + params.sq_off.array);
+    u->sq_mask = *(unsigned*)((uint8_t*)u->ring + params.sq_off.ring_mask);
+    u->sq_entries = params.sq_entries;
+
+    u->cq_head = (unsigned*)((uint8_t*)u->ring + params.cq_off.head);
+    u->cq_tail = (unsigned*)((uint8_t*)u->ring + params.cq_off.tail);
+    u->cq_mask = *(unsigned*)((uint8_t*)u->ring + params.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)((uint8_t*)u->ring + params.cq_off.cqes);
+
+    mdev->uring = u;
+    return MSP_OK;
+
+setup_error:
+    close(u->ring_fd);
+    free(u);
+    return MSP_SYSCALL_FAIL;
+}
+
+/**
+ *  Take the link off io_uring
+ *
+ *  @param mdev     [in]    an MSP device pointer
+ *
+ *  The armed read targets memory that is about to be freed, so it is
+ *  cancelled and its completion waited for before the ring goes away.
+ *  Call this before the fd is closed.
+ *
+ */
+void uring_teardown(mspdev_t* mdev) {
+
+    struct mspuring* u = mdev->uring;
+    struct io_uring_sqe* sqe;
+    int64_t deadline = monotonic_us() + URING_CANCEL_TIMEOUT_US;
+
+    if (u == NULL) {return;}
+
+    uring_reap(mdev);
+
+    if (u->read_pending) {
+        sqe = uring_get_sqe(u);
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = URING_TAG_POLL;
+            sqe->user_data = URING_TAG_CANCEL;
+            uring_commit_sqe(u);
+        }
+
+        while (u->read_pending && monotonic_us() < deadline) {
+            if (uring_enter(mdev, 1, deadline) < 0) {break;}
+            uring_reap(mdev);
+        }
+    }
+
+    munmap(u->sqes, u->sqes_len);
+    munmap(u->ring, u->ring_len);
+    close(u->ring_fd);
+    free(u);
+
+    mdev->uring = NULL;
+}
+
+// fd_wait() for io_uring links: 1 when staged data is ready, 0 at the deadline, or MSP_SYSCALL_FAIL
+int uring_wait(mspdev_t* mdev, int64_t deadline) {
+
+    struct mspuring* u = mdev->uring;
+    int entered = 0;
+    int ret;
+
+    for (;;) {
+        uring_reap(mdev);
+
+        if (u->staged > 0) {return 1;}
+
+        if (u->read_error) {
+            mdev->errornum = u->read_error;
+            u->read_error = 0;
+            return MSP_SYSCALL_FAIL;
+        }
+
+        if (entered && monotonic_us() >= deadline) {return 0;}
+
+        uring_arm_read(mdev);
+
+        // Enter at least once, even past the deadline: completions only surface on a trip into
+        // the kernel, and the read has to be in flight for the ring fd to report the next input
+        ret = uring_enter(mdev, 1, deadline);
+        if (ret<0) {return ret;}
+        entered = 1;
+    }
+}
+
+// The ring fd turns readable once the armed read completes, which is what an event loop has to watch
+int uring_fileno(mspdev_t* mdev) {
+
+    int ret;
+
+    uring_reap(mdev);
+    uring_arm_read(mdev);
+
+    ret = uring_enter(mdev, 0, -1);
+    if (ret<0) {return ret;}
+
+    return mdev->uring->ring_fd;
+}
+
+// fd_read() for io_uring links: hands out staged bytes without a syscall
+ssize_t uring_read(mspdev_t* mdev, struct iovec* iov, int iovcnt) {
+
+    struct mspuring* u = mdev->uring;
+    size_t total = 0;
+    size_t chunk;
+
+    uring_reap(mdev);
+
+    for (int i = 0; i < iovcnt && u->staged > 0; i++) {
+        chunk = (iov[i].iov_len < u->staged) ? iov[i].iov_len : u->staged;
+        memcpy(iov[i].iov_base, &u->staging[u->staged_off], chunk);
+        u->staged_off += chunk;
+        u->staged -= chunk;
+        total += chunk;
+    }
+
+    if (total == 0 && u->read_error) {
+        mdev->errornum = u->read_error;
+        u->read_error = 0;
+        return MSP_SYSCALL_FAIL;
+    }
+
+    return total;
+}
+
+// fd_writev() for io_uring links. A pending read re-arm goes into the kernel with the write.
+ssize_t uring_writev(mspdev_t* mdev, struct iovec* iov, int iovcnt) {
+
+    struct mspuring* u = mdev->uring;
+    struct io_uring_sqe* sqe;
+    int ret;
+
+    uring_reap(mdev);
+    uring_arm_read(mdev);
+
+    sqe = uring_get_sqe(u);
+    if (sqe == NULL) {
+        mdev->errornum = EBUSY;
+        return MSP_SYSCALL_FAIL;
+    }
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = mdev->fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = iovcnt;
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = URING_TAG_WRITE;
+    uring_commit_sqe(u);
+
+    u->write_pending = 1;
+
+    while (u->write_pending) {
+        ret = uring_enter(mdev, 1, -1);
+        if (ret<0) {return ret;}
+        uring_reap(mdev);
+    }
+
+    if (u->write_result < 0) {
+        mdev->errornum = -u->write_result;
+        return MSP_SYSCALL_FAIL;
+    }
+
+    return u->write_result;
+}
+
+// Bytes received through io_uring that the parser hasn't seen yet
+size_t uring_buffered(mspdev_t* mdev) {
+    uring_reap(mdev);
+    return mdev->uring->staged;
+}
+
+// Drop staged input, returning how much was dropped
+size_t uring_discard(mspdev_t* mdev) {
+
+    size_t dropped = uring_buffered(mdev);
+
+    mdev->uring->staged = 0;
+    mdev->uring->staged_off = 0;
+
+    return dropped;
+}
+
+#else   // no io_uring, setup always fails and the link stays on plain syscalls
+
+int uring_setup(mspdev_t* mdev) {
+    mdev->errornum = ENOSYS;
+    return MSP_SYSCALL_FAIL;
+}
+
+void uring_teardown(mspdev_t* mdev) {}
+int uring_wait(mspdev_t* mdev, int64_t deadline) {return MSP_LIB_INTERNAL_ERROR;}
+int uring_fileno(mspdev_t* mdev) {return MSP_LIB_INTERNAL_ERROR;}
+ssize_t uring_read(mspdev_t* mdev, struct iovec* iov, int iovcnt) {return MSP_LIB_INTERNAL_ERROR;}
+ssize_t uring_writev(mspdev_t* mdev, struct iovec* iov, int iovcnt) {return MSP_LIB_INTERNAL_ERROR;}
+size_t uring_buffered(mspdev_t* mdev) {return 0;}
+size_t uring_discard(mspdev_t* mdev) {return 0;}
+
+#endif
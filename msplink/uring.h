@@ -0,0 +1,37 @@
+/*
+This file is part of python-msptools.
+
+Python-msptools is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Python-msptools is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with python-msptools.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "msplink.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define MSPLINK_HAVE_IO_URING 1
+#endif
+#endif
+
+int uring_setup(mspdev_t* mdev);
+void uring_teardown(mspdev_t* mdev);
+int uring_wait(mspdev_t* mdev, int64_t deadline);
+int uring_fileno(mspdev_t* mdev);
+ssize_t uring_read(mspdev_t* mdev, struct iovec* iov, int iovcnt);
+ssize_t uring_writev(mspdev_t* mdev, struct iovec* iov, int iovcnt);
+size_t uring_buffered(mspdev_t* mdev);
+size_t uring_discard(mspdev_t* mdev);